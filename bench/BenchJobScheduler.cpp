@@ -0,0 +1,344 @@
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./../src/JobScheduler.h"
+#include "./../src/StaticDag.h"
+
+// Benchmarks for the job scheduler. Every task performs (close to) no work, so the
+//  measured time is dominated by the per-task overhead of the scheduler.
+
+typedef std::function<void(JobScheduler<std::string>&)> graph_generator_t;
+
+
+/// \brief Generate "nr_chains" independent linear chains of "chain_length" tasks each
+/// \param[in] Number of chains
+/// \param[in] Number of tasks per chain
+/// \return A function adding the graph to a job scheduler
+graph_generator_t GenerateChains(uint32_t nr_chains, uint32_t chain_length) {
+    return [nr_chains, chain_length](JobScheduler<std::string>& job) {
+        for(uint32_t c = 0; c < nr_chains; c++) {
+            uint32_t first = c * chain_length;
+            for(uint32_t t = first + 1; t < first + chain_length; t++) {
+                job.AddTask(t, t - 1);
+            }
+        }
+    };
+}
+
+
+/// \brief Generate a root task fanning out into "width" micro tasks, which are all
+///        joined by a single sink task
+/// \param[in] Number of micro tasks
+/// \return A function adding the graph to a job scheduler
+graph_generator_t GenerateFanOut(uint32_t width) {
+    return [width](JobScheduler<std::string>& job) {
+        uint32_t sink = width + 1;
+        for(uint32_t t = 1; t <= width; t++) {
+            job.AddTask(t, 0);
+            job.AddTask(sink, t);
+        }
+    };
+}
+
+
+/// \brief Run one job and report the time until all of its tasks are done
+/// \param[in] Name of the benchmark
+/// \param[in] Generator of the task graph
+/// \param[in] Whether to run the graph compilation pass
+/// \param[in] Grain size for the graph compilation pass
+/// \return Elapsed time in microseconds
+double RunJob(const std::string& name,
+              graph_generator_t generate,
+              bool compile,
+              uint32_t grain_size) {
+    std::shared_ptr<GlobalState<std::string>> global_state_ptr =
+        std::make_shared<GlobalState<std::string>>();
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::unique_ptr<JobScheduler<std::string>> job_ptr =
+        std::make_unique<JobScheduler<std::string>>(global_state_ptr);
+    job_ptr->SetWork([global_state_ptr](const uint32_t, const uint32_t) {
+        global_state_ptr->Add(".");
+    });
+    generate(*job_ptr);
+
+    GraphCompileStats stats;
+    if(compile) {
+        stats = job_ptr->CompileGraph(grain_size);
+    }
+    job_ptr->ProcessTasks();
+    job_ptr->Handle().Wait();
+
+    auto end = std::chrono::steady_clock::now();
+    double elapsed_us = std::chrono::duration<double, std::micro>(end - start).count();
+    uint32_t nr_tasks = global_state_ptr->GetState().size();
+
+    std::cout << name << (compile ? " [compiled, grain=" + std::to_string(grain_size) + "]" : "")
+              << ": tasks = " << nr_tasks;
+    if(compile) {
+        std::cout << ", units = " << stats.nr_units
+                  << " (fused " << stats.nr_fused << ", coalesced " << stats.nr_coalesced << ")";
+    }
+    std::cout << ", elapsed = " << elapsed_us / 1000.0 << " ms"
+              << ", per task = " << elapsed_us / nr_tasks << " us" << std::endl;
+    return elapsed_us;
+}
+
+
+/// \brief Compare a generated graph with and without the graph compilation pass
+/// \param[in] Name of the benchmark
+/// \param[in] Generator of the task graph
+/// \param[in] Grain size for the graph compilation pass
+/// \return None
+void BenchCompileGraph(const std::string& name,
+                       graph_generator_t generate,
+                       uint32_t grain_size) {
+    double baseline_us = RunJob(name, generate, false, 1);
+    double compiled_us = RunJob(name, generate, true, grain_size);
+    std::cout << name << ": speedup = " << baseline_us / compiled_us << "x" << std::endl;
+}
+
+
+/// \brief Perform a fixed amount of work, which the compiler cannot remove
+/// \param[in] Number of iterations
+/// \return A value depending on every iteration
+static uint64_t SpinWork(uint64_t nr_iterations) {
+    volatile uint64_t x = 0;
+    for(uint64_t i = 0; i < nr_iterations; i++) {
+        x = x * 2654435761u + i;
+    }
+    return x;
+}
+
+
+/// \brief Task 0 spawns "width" tasks, each performing "nr_iterations" iterations of
+///        work, before task 1 runs. Compares the elapsed time with performing the same
+///        work serially on one thread.
+/// \param[in] Name of the benchmark
+/// \param[in] Number of spawned tasks
+/// \param[in] Iterations of work of every spawned task
+/// \return None
+void BenchNestedForkJoin(const std::string& name, uint32_t width, uint64_t nr_iterations) {
+    std::shared_ptr<GlobalState<std::string>> global_state_ptr =
+        std::make_shared<GlobalState<std::string>>();
+    JobScheduler<std::string> job(global_state_ptr);
+    job.AddTask(1, 0);
+    // spawned tasks are admitted under the load limit, allow one per core
+    const uint32_t nr_cores = std::max(std::thread::hardware_concurrency(), 1u);
+    job.SetMaxConcurrentTasks(nr_cores);
+
+    SubGraph sub_graph;
+    for(uint32_t t = 0; t < width; t++) {
+        sub_graph.AddTask(t);
+    }
+    sub_graph.SetWork([nr_iterations](const uint32_t, const CancellationToken&) {
+        SpinWork(nr_iterations);
+    });
+
+    JobScheduler<std::string>* job_ptr = &job;
+    job.SetWork([job_ptr, sub_graph](const uint32_t, const uint32_t data) {
+        if(data == 0) {
+            job_ptr->Spawn(sub_graph);
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t t = 0; t < width; t++) {
+        SpinWork(nr_iterations);
+    }
+    auto serial_end = std::chrono::steady_clock::now();
+    job.ProcessTasks();
+    job.Handle().Wait();
+    auto end = std::chrono::steady_clock::now();
+
+    double serial_us = std::chrono::duration<double, std::micro>(serial_end - start).count();
+    double elapsed_us = std::chrono::duration<double, std::micro>(end - serial_end).count();
+    std::cout << name << ": spawned = " << width << ", elapsed = " << elapsed_us / 1000.0 << " ms"
+              << ", serial = " << serial_us / 1000.0 << " ms"
+              << ", speedup = " << serial_us / elapsed_us << "x"
+              << " (" << nr_cores << " cores)" << std::endl;
+}
+
+
+/// \brief Simulate a layered job of "nr_layers" x "width" tasks, every task depending
+///        on two tasks of the previous layer, and sweep the load limit
+/// \param[in] Name of the benchmark
+/// \param[in] Number of layers
+/// \param[in] Number of tasks per layer
+/// \return None
+void BenchSimulate(const std::string& name, uint32_t nr_layers, uint32_t width) {
+    std::shared_ptr<GlobalState<std::string>> global_state_ptr =
+        std::make_shared<GlobalState<std::string>>();
+    JobScheduler<std::string> job(global_state_ptr);
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t l = 1; l < nr_layers; l++) {
+        for(uint32_t w = 0; w < width; w++) {
+            job.AddTask(l * width + w, (l - 1) * width + w);
+            job.AddTask(l * width + w, (l - 1) * width + (w * 7 + 1) % width);
+        }
+    }
+    auto built = std::chrono::steady_clock::now();
+
+    // 1-10ms per task
+    task_cost_function_t cost = [](const uint32_t task_id) {
+        return 0.001 * (1 + (task_id * 2654435761u) % 10);
+    };
+    ConcurrencySweep sweep = job.SweepConcurrency(cost, 16, {4, 8, 16, 32, 64});
+    auto end = std::chrono::steady_clock::now();
+
+    for(const auto& report : sweep.reports) {
+        std::cout << name << ": max_concurrent_tasks = " << report.max_concurrent_tasks
+                  << ", makespan = " << report.makespan << " s"
+                  << ", utilization = " << report.utilization
+                  << ", critical path = " << report.critical_path_length << " s ("
+                  << report.critical_path.size() << " tasks)" << std::endl;
+    }
+    std::cout << name << ": tasks = " << nr_layers * width
+              << ", build = " << std::chrono::duration<double>(built - start).count() << " s"
+              << ", simulate x" << sweep.reports.size() << " = "
+              << std::chrono::duration<double>(end - built).count() << " s"
+              << ", recommended max_concurrent_tasks = "
+              << sweep.recommended_max_concurrent_tasks << std::endl;
+}
+
+
+/// \brief Build a graph of "nr_tasks" tasks (two dependencies each) via AddTask on one
+///        thread, and via a GraphBuilder filled by different numbers of threads. Reports
+///        the scaling of the producers (relative to the first number of threads) and the
+///        time to merge their dependencies into the job
+/// \param[in] Name of the benchmark
+/// \param[in] Number of tasks
+/// \param[in] Numbers of producer threads
+/// \return None
+void BenchGraphBuilder(const std::string& name,
+                       uint32_t nr_tasks,
+                       const std::vector<uint32_t>& nr_producers) {
+    std::shared_ptr<GlobalState<std::string>> global_state_ptr =
+        std::make_shared<GlobalState<std::string>>();
+
+    double serial_s;
+    {
+        JobScheduler<std::string> job(global_state_ptr);
+        auto start = std::chrono::steady_clock::now();
+        for(uint32_t t = 1; t < nr_tasks; t++) {
+            job.AddTask(t, t - 1);
+            job.AddTask(t, t / 2);
+        }
+        auto end = std::chrono::steady_clock::now();
+        serial_s = std::chrono::duration<double>(end - start).count();
+        std::cout << name << " [AddTask]: elapsed = " << serial_s << " s" << std::endl;
+    }
+
+    double first_produce_s = 0;
+    for(const auto nr_threads : nr_producers) {
+        JobScheduler<std::string> job(global_state_ptr);
+        GraphBuilder builder;
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> producers;
+        for(uint32_t p = 0; p < nr_threads; p++) {
+            producers.emplace_back([&builder, p, nr_threads, nr_tasks]() {
+                for(uint32_t t = 1 + p; t < nr_tasks; t += nr_threads) {
+                    builder.AddTask(t, t - 1);
+                    builder.AddTask(t, t / 2);
+                }
+            });
+        }
+        for(auto& producer : producers) {
+            producer.join();
+        }
+        auto produced = std::chrono::steady_clock::now();
+        job.AddTasks(builder);
+        auto end = std::chrono::steady_clock::now();
+
+        double elapsed_s = std::chrono::duration<double>(end - start).count();
+        double produce_s = std::chrono::duration<double>(produced - start).count();
+        if(first_produce_s == 0) {
+            first_produce_s = produce_s;
+        }
+        std::cout << name << " [GraphBuilder, " << nr_threads << " producers]: produce = "
+                  << produce_s << " s (scaling = " << first_produce_s / produce_s << "x)"
+                  << ", merge = " << std::chrono::duration<double>(end - produced).count() << " s"
+                  << ", speedup = " << serial_s / elapsed_s << "x"
+                  << " (" << std::thread::hardware_concurrency() << " cores)" << std::endl;
+    }
+}
+
+
+/*
+     0  1
+    / \/ \
+    2  3  4 -- 6
+    \     /
+     5----  
+*/
+static constexpr auto kReadmeDag = MakeStaticDag<7>({
+    {2, 0}, {3, 0}, {3, 1}, {4, 1}, {5, 2}, {4, 5}, {6, 4}});
+
+
+/// \brief Edges of a root task fanning out into W tasks joined by a sink task
+///        (same shape as GenerateFanOut)
+/// \return The edges
+template <uint32_t W>
+constexpr std::array<StaticEdge, 2 * W> FanOutEdges() {
+    std::array<StaticEdge, 2 * W> edges {};
+    for(uint32_t t = 1; t <= W; t++) {
+        edges[2 * (t - 1)] = {t, 0};
+        edges[2 * (t - 1) + 1] = {W + 1, t};
+    }
+    return edges;
+}
+static constexpr StaticDag<66, 128> kFanOutDag(FanOutEdges<64>());
+
+
+/// \brief Compare the StaticExecutor with the runtime JobScheduler path on the same DAG
+/// \param[in] Name of the benchmark
+/// \param[in] Number of times each DAG is executed
+/// \return None
+template <const auto& Dag>
+void BenchStaticDag(const std::string& name, uint32_t repetitions) {
+    double runtime_us = 0;
+    for(uint32_t r = 0; r < repetitions; r++) {
+        runtime_us += RunJob(name + " [runtime]", [](JobScheduler<std::string>& job) {
+            for(std::size_t e = 0; e < Dag.NrEdges(); e++) {
+                job.AddTask(Dag.Edge(e).task_id, Dag.Edge(e).depends_on_task_id);
+            }
+        }, false, 1);
+    }
+
+    double static_us = 0;
+    for(uint32_t r = 0; r < repetitions; r++) {
+        GlobalState<std::string> global_state;
+        auto start = std::chrono::steady_clock::now();
+
+        StaticExecutor<Dag> executor;
+        executor.Run([&global_state](uint32_t) { global_state.Add("."); }, 4);
+
+        auto end = std::chrono::steady_clock::now();
+        static_us += std::chrono::duration<double, std::micro>(end - start).count();
+    }
+
+    std::cout << name << ": runtime = " << runtime_us / repetitions / 1000.0 << " ms"
+              << ", static = " << static_us / repetitions / 1000.0 << " ms"
+              << ", per task = " << static_us / repetitions / Dag.NrTasks() << " us"
+              << ", speedup = " << runtime_us / static_us << "x" << std::endl;
+}
+
+
+int main() {
+    BenchCompileGraph("chains(10x20)", GenerateChains(10, 20), 1);
+    BenchCompileGraph("fan_out(200)", GenerateFanOut(200), 32);
+    BenchStaticDag<kReadmeDag>("static readme dag", 5);
+    BenchStaticDag<kFanOutDag>("static fan_out(64)", 5);
+    BenchNestedForkJoin("nested fork-join(64)", 64, 20000000);
+    BenchSimulate("simulate(1000x1000)", 1000, 1000);
+    BenchGraphBuilder("build(1M)", 1000000, {1, 2, 4, 8});
+    return 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+typedef std::chrono::steady_clock::time_point deadline_t;
+
+
+/// \brief Thrown by a task which stops because it was cancelled or ran past its deadline.
+class TaskCancelled : public std::runtime_error {
+    public:
+        TaskCancelled(const std::string& what) : std::runtime_error(what) {}
+};
+
+
+/// \brief A CancellationToken is handed to every task. Cancellation is cooperative: a
+///        task is expected to check the token (or sleep via SleepFor) and return early
+///        once it is cancelled. All tokens derived from the same job share one cancel
+///        flag, each token can have its own deadline on top of the job's deadline.
+class CancellationToken {
+    private:
+        std::shared_ptr<std::atomic<bool>> cancelled_;
+        deadline_t deadline_;
+
+    public:
+        CancellationToken() :
+            cancelled_(std::make_shared<std::atomic<bool>>(false)),
+            deadline_(deadline_t::max()) {}
+
+        /// \brief Create a token on an existing cancel flag (e.g. in shared memory)
+        CancellationToken(std::shared_ptr<std::atomic<bool>> cancelled, deadline_t deadline) :
+            cancelled_(cancelled),
+            deadline_(deadline) {}
+
+        /// \brief Derive a token sharing the cancel flag of "parent". The resulting
+        ///        deadline is the earlier one of "parent" and "deadline".
+        CancellationToken(const CancellationToken& parent, deadline_t deadline) :
+            cancelled_(parent.cancelled_),
+            deadline_(std::min(parent.deadline_, deadline)) {}
+
+        /// \brief Cancel this token and all tokens derived from the same job
+        /// \return None
+        void Cancel() const {
+            *cancelled_ = true;
+        }
+
+        /// \brief Check if the token was cancelled or its deadline has passed
+        /// \return True if the task should stop. False, otherwise
+        bool IsCancelled() const {
+            return *cancelled_ || std::chrono::steady_clock::now() >= deadline_;
+        }
+
+        /// \brief Throw TaskCancelled if the token was cancelled or its deadline has passed
+        /// \return None
+        void ThrowIfCancelled() const {
+            if(IsCancelled()) {
+                throw TaskCancelled("task cancelled");
+            }
+        }
+
+        /// \brief Return the deadline of this token
+        /// \return The deadline. (deadline_t::max() if there is none)
+        deadline_t Deadline() const {
+            return deadline_;
+        }
+
+        /// \brief Sleep, but wake up within a few milliseconds if the token is cancelled
+        /// \param[in] Duration to sleep
+        /// \return True if the full duration was slept. False if cancelled
+        template <class Rep, class Period>
+        bool SleepFor(std::chrono::duration<Rep, Period> duration) const {
+            const std::chrono::milliseconds slice(5);
+            auto end = std::chrono::steady_clock::now() + duration;
+
+            while(std::chrono::steady_clock::now() < end) {
+                if(IsCancelled()) {
+                    return false;
+                }
+                auto remaining = end - std::chrono::steady_clock::now();
+                if(remaining > slice) {
+                    std::this_thread::sleep_for(slice);
+                } else {
+                    std::this_thread::sleep_for(remaining);
+                }
+            }
+            return !IsCancelled();
+        }
+};
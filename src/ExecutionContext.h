@@ -2,19 +2,14 @@
 #pragma once
 
 #include "System.h"
+#include "Cancellation.h"
 
 // #define __DEBUG__
 
 
-/// \brief Chain two functions together
-/// \param[in] first function with return type void and no arguments
-/// \param[in] second function with return type void and no arguments
-/// \return None
-static void Chain(std::function<void()> f1,
-                  std::function<void()> f2) {
-    f1();
-    f2();
-}
+// work of an execution context, which may check the given token to stop early
+typedef std::function<void(const CancellationToken&)> context_work_function_t;
+
 
 /// \brief An ExecutionContext exists part of a job. It has enough information to execute
 ///        I.e., it knows about its dependencies on other tasks and is provided a function
@@ -40,30 +35,60 @@ class ExecutionContext {
         /// \brief Execute a given function within a certain execution context (meaning
         ///        start the execution when tasks we depend on are done.
         ///        In this function execution is handled by independent threads
-        /// \param[in] Function to be executed. Parameterless, i.e., the job scheduler has
-        ///            already provided/bound all the necessary params. Also no return
+        /// \param[in] Function to be executed. The job scheduler has already provided/bound
+        ///            all the necessary params except for the cancellation token. No return
         ///            value for the given function since it operates on a state object.
+        ///            Throwing an exception marks this execution as failed.
         /// \param[in] A representation of the underlying system, which keeps track of
         ///            running workers (here: threads) and their state
+        /// \param[in] The cancellation token of the job. (deadlines of single tasks are
+        ///            handled by the work itself)
+        /// \param[in] Called with the id of this execution if it failed or is skipped, to
+        ///            skip all executions depending on it
         /// \return None
-        void Execute(std::function<void()> work,
-                     System& s) {
+        void Execute(context_work_function_t work,
+                     System& s,
+                     const CancellationToken& job_token,
+                     std::function<void(uint32_t)> skip_dependents) {
 
             #ifdef __DEBUG__
                 std::cout << "Preparing ExecutionContext: #" << id_ << std::endl;
             #endif
     		
+            uint32_t id = id_;
             std::vector<uint32_t> parent_ids = parent_ids_;
-            std::function<void()> wait_for_parent_tasks = [parent_ids, &s]() -> void {
-                s.WaitForTasks(parent_ids); };
+            std::function<void()> run = [id, parent_ids, work, job_token,
+                                         skip_dependents, &s]() -> void {
+                // before executing the given function, we ensure dependent tasks are done.
+                //  if one of them failed (or the job got cancelled), we do not run at all
+                if(!s.WaitForTasks(parent_ids, job_token)) {
+                    s.SkipTask(id);
+                    skip_dependents(id);
+                    s.FinishTask(id);
+                    return;
+                }
+
+                // the work may spawn further tasks on behalf of this execution
+                System::SetCurrentTask(id);
+                try {
+                    work(job_token);
+                    // finishing after the job deadline counts as a failure as well
+                    job_token.ThrowIfCancelled();
+                } catch(...) {
+                    s.FailTask(id, std::current_exception());
+                    skip_dependents(id);
+                }
+                System::SetCurrentTask(-1);
+
+                // completes once the tasks spawned by the work are completed as well
+                s.FinishTask(id);
+            };
 
-            // fire up a new asynchronous execution for the given work function. A few
-            //  important comments:
-            // 1. before executing the given function, we ensure dependent tasks are done
-            // 2. the return of std::async is a future (result), which cannot be copied
-            //    to the "System" keeping track of active calculations. it has to be moved
+            // fire up a new asynchronous execution for the given work function. the return
+            //  of std::async is a future (result), which cannot be copied to the "System"
+            //  keeping track of active calculations. it has to be moved
             s.AddTask(id_,
-                      std::move(std::async(Chain, wait_for_parent_tasks, work))
+                      std::move(std::async(std::launch::async, run))
                       );
 			
             #ifdef __DEBUG__
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mutex.h"
+
+// (task_id, depends_on_task_id), same meaning as JobScheduler::AddTask
+typedef std::pair<uint32_t, uint32_t> graph_edge_t;
+
+
+/// \brief Collects the dependencies of a job from many producer threads at the same time
+///        (e.g. parsers), to be merged into a job scheduler via JobScheduler::AddTasks.
+///        Every thread appends to one of many shards, picked by the id of the thread, so
+///        producers rarely share a lock.
+class GraphBuilder {
+    private:
+        // aligned to separate cache lines, producers of different shards do not interfere
+        struct alignas(64) Shard {
+            Mutex mutex;
+            std::vector<graph_edge_t> edges GUARDED_BY(mutex);
+        };
+        std::vector<std::unique_ptr<Shard>> shards_;
+
+        /// \brief Return the shard of the calling thread
+        /// \return The shard
+        Shard& ThreadShard() {
+            static thread_local const size_t thread_hash =
+                std::hash<std::thread::id>()(std::this_thread::get_id());
+            return *shards_[thread_hash % shards_.size()];
+        }
+
+    public:
+        /// \brief Create a builder
+        /// \param[in] Number of shards, defaults to a few per hardware thread
+        GraphBuilder(uint32_t nr_shards = 0) {
+            if(nr_shards == 0) {
+                nr_shards = 8 * std::max(std::thread::hardware_concurrency(), 1u);
+            }
+            for(uint32_t s = 0; s < nr_shards; s++) {
+                shards_.emplace_back(std::make_unique<Shard>());
+            }
+        }
+
+        /// \brief Add a dependency, same as JobScheduler::AddTask. Thread-safe.
+        /// \param[in] A unique id representing an execution/task
+        /// \param[in] The id of the task this task depends on
+        /// \return None.
+        void AddTask(uint32_t task_id, uint32_t depends_on_task_id) {
+            Shard& shard = ThreadShard();
+            MutexLocker lock(&shard.mutex);
+            shard.edges.emplace_back(task_id, depends_on_task_id);
+        }
+
+        /// \brief Return the partition of a task, used to merge the dependencies in
+        ///        parallel (see JobScheduler::AddTasks). Ids are hashed, so consecutive
+        ///        or strided ids spread over all partitions.
+        /// \param[in] The id of the task
+        /// \param[in] Number of partitions
+        /// \return Index of the partition
+        static uint32_t Partition(uint32_t task_id, uint32_t nr_partitions) {
+            return ((static_cast<uint64_t>(task_id) * 0x9E3779B97F4A7C15ull) >> 32) % nr_partitions;
+        }
+
+        /// \brief Move all dependencies out of the builder, which is empty afterwards.
+        ///        Dependencies added by one thread stay in the order they were added.
+        /// \return The dependencies of every shard
+        std::vector<std::vector<graph_edge_t>> TakeEdges() {
+            std::vector<std::vector<graph_edge_t>> edges;
+            for(auto& shard : shards_) {
+                MutexLocker lock(&shard->mutex);
+                edges.emplace_back(std::move(shard->edges));
+                shard->edges.clear();
+            }
+            return edges;
+        }
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "mutex.h"
+
+// called whenever a task of a job completes (successfully, failed or skipped)
+//  with (id of the task, number of completed tasks, total number of tasks)
+typedef std::function<void(uint32_t, uint32_t, uint32_t)> progress_callback_t;
+
+
+/// \brief Completion state of a job, shared by the job scheduler and all handles of the
+///        job. A counter of completed tasks is compared against the total
+///        number of tasks, there is no polling of running tasks.
+class JobCompletion {
+    private:
+        Mutex mutex_;
+        bool started_ GUARDED_BY(mutex_);
+        bool fulfilled_ GUARDED_BY(mutex_);
+        uint32_t nr_total_ GUARDED_BY(mutex_);
+        uint32_t nr_completed_ GUARDED_BY(mutex_);
+        uint32_t nr_reported_ GUARDED_BY(mutex_); // completed tasks, callbacks fired
+        std::vector<progress_callback_t> callbacks_ GUARDED_BY(mutex_);
+        std::promise<void> promise_;
+        std::shared_future<void> future_;
+
+        /// \brief Check if all tasks are completed for the first time
+        /// \return True if the job just became done. False, otherwise
+        bool BecameDone() REQUIRES(mutex_) {
+            if(fulfilled_ || !started_ || nr_reported_ != nr_total_) {
+                return false;
+            }
+            fulfilled_ = true;
+            return true;
+        }
+
+    public:
+        JobCompletion() :
+            started_(false),
+            fulfilled_(false),
+            nr_total_(0),
+            nr_completed_(0),
+            nr_reported_(0),
+            future_(promise_.get_future().share()) {}
+
+        /// \brief Mark the job as started. Before, the job is never done, even if it
+        ///        does not have any tasks.
+        /// \param[in] Number of tasks of the job
+        /// \return None
+        void Start(uint32_t nr_tasks) {
+            bool done;
+            {
+                MutexLocker lock(&mutex_);
+                started_ = true;
+                nr_total_ += nr_tasks;
+                done = BecameDone();
+            }
+            if(done) {
+                promise_.set_value();
+            }
+        }
+
+        /// \brief Add tasks to a started job (e.g. spawned by a running task)
+        /// \param[in] Number of additional tasks
+        /// \return None
+        void AddTasks(uint32_t nr_tasks) {
+            MutexLocker lock(&mutex_);
+            nr_total_ += nr_tasks;
+        }
+
+        /// \brief Count a completed task and fire the progress callbacks
+        /// \param[in] The id of the completed task
+        /// \return None
+        void Complete(uint32_t task_id) {
+            std::vector<progress_callback_t> callbacks;
+            uint32_t nr_completed;
+            uint32_t nr_total;
+            bool done;
+            {
+                MutexLocker lock(&mutex_);
+                nr_completed = ++nr_completed_;
+                nr_total = nr_total_;
+                callbacks = callbacks_;
+            }
+
+            // callbacks are called without holding the lock, they may query the job
+            for(const auto& callback : callbacks) {
+                callback(task_id, nr_completed, nr_total);
+            }
+
+            // the job is done once all callbacks have returned
+            {
+                MutexLocker lock(&mutex_);
+                nr_reported_++;
+                done = BecameDone();
+            }
+            if(done) {
+                promise_.set_value();
+            }
+        }
+
+        /// \brief Register a progress callback
+        /// \param[in] The callback
+        /// \return None
+        void OnProgress(progress_callback_t callback) {
+            MutexLocker lock(&mutex_);
+            callbacks_.emplace_back(callback);
+        }
+
+        /// \brief Block until all tasks of the job are completed
+        /// \return None
+        void Wait() {
+            future_.wait();
+        }
+
+        /// \brief Block until all tasks of the job are completed or the
+        ///        timeout elapsed
+        /// \param[in] Maximum time to wait
+        /// \return True if the job is done. False, otherwise
+        template <class Rep, class Period>
+        bool WaitFor(std::chrono::duration<Rep, Period> timeout) {
+            return future_.wait_for(timeout) == std::future_status::ready;
+        }
+
+        /// \brief Return a future, which becomes ready once the job is done
+        /// \return The future
+        std::shared_future<void> Future() {
+            return future_;
+        }
+
+        /// \brief Return the number of completed tasks
+        /// \return Number of completed tasks
+        uint32_t NrCompleted() {
+            MutexLocker lock(&mutex_);
+            return nr_completed_;
+        }
+
+        /// \brief Return the total number of tasks
+        /// \return Number of tasks
+        uint32_t NrTotal() {
+            MutexLocker lock(&mutex_);
+            return nr_total_;
+        }
+};
+
+
+/// \brief Handle to a job, e.g. to wait for it. Handles are cheap to copy and stay
+///        valid after the job scheduler is destroyed.
+class JobHandle {
+    private:
+        std::shared_ptr<JobCompletion> completion_;
+
+    public:
+        JobHandle(std::shared_ptr<JobCompletion> completion) :
+            completion_(completion) {}
+
+        /// \brief Block until all tasks of the job are done (successfully, failed or
+        ///        skipped)
+        /// \return None
+        void Wait() {
+            completion_->Wait();
+        }
+
+        /// \brief Block until all tasks of the job are done or the timeout elapsed
+        /// \param[in] Maximum time to wait
+        /// \return True if the job is done. False, otherwise
+        template <class Rep, class Period>
+        bool WaitFor(std::chrono::duration<Rep, Period> timeout) {
+            return completion_->WaitFor(timeout);
+        }
+
+        /// \brief Return a future, which becomes ready once the job is done
+        /// \return The future
+        std::shared_future<void> Future() {
+            return completion_->Future();
+        }
+
+        /// \brief Register a callback fired whenever a task completes
+        /// \param[in] The callback
+        /// \return None
+        void OnProgress(progress_callback_t callback) {
+            completion_->OnProgress(callback);
+        }
+
+        /// \brief Return the number of completed tasks
+        /// \return Number of completed tasks
+        uint32_t NrCompleted() {
+            return completion_->NrCompleted();
+        }
+
+        /// \brief Return the total number of tasks
+        /// \return Number of tasks
+        uint32_t NrTotal() {
+            return completion_->NrTotal();
+        }
+};
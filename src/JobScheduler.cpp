@@ -8,17 +8,20 @@
 ///         In this example we also experiment with the fact that certain tasks can take
 ///         longer as other tasks. Duration is simulated via sleeps.
 template <class T>
-void_work_function_t JobScheduler<T>::CreateWork() {
-    void_work_function_t work = [this](
+cancellable_work_function_t JobScheduler<T>::CreateWork() {
+    cancellable_work_function_t work = [this](
         const uint32_t sleep_time_sec,
-        const uint32_t data) {
+        const uint32_t data,
+        const CancellationToken& token) {
 
         // if the data element being processed is a "2", we sleep extra
         if(data == 2) {
-            std::this_thread::sleep_for(std::chrono::seconds(10));
+            token.SleepFor(std::chrono::seconds(10));
         }
     	
-        std::this_thread::sleep_for(std::chrono::seconds(sleep_time_sec));
+        token.SleepFor(std::chrono::seconds(sleep_time_sec));
+        // a cancelled task does not alter the state
+        token.ThrowIfCancelled();
         global_state_->Add(std::to_string(data));
         
         #ifdef __DEBUG__
@@ -29,24 +32,34 @@ void_work_function_t JobScheduler<T>::CreateWork() {
 }
 
 
-/// \brief Find initial tasks with indegree of 0. These are the starting points of
-///        the overall scheduling algorithm.
-/// \return None.
+/// \brief Kahn's algorithm (BFS) over the graph, starting with the tasks which do not
+///        depend on any other task. This is the order in which ProcessTasks dispatches
+///        the execution units. Tasks on a cycle never reach an indegree of 0 and are
+///        missing from the order.
+/// \return Ids of the execution units in dispatch order
 template <class T>
-void JobScheduler<T>::QueueUpIndependentTasks() {
-    std::set<uint32_t> dependent_tasks;
-    
-    for(const auto& t : task_adj_list_) {
-        for(const auto d: t.second) {
-            dependent_tasks.insert(d);
+std::vector<uint32_t> JobScheduler<T>::DispatchOrder() {
+    std::unordered_map<uint32_t, uint32_t> indegrees = indegrees_;
+    std::vector<uint32_t> order;
+    order.reserve(task_ids_.size());
+
+    for(const auto& t : task_ids_) {
+        if(indegrees[t] == 0) {
+            order.emplace_back(t);
         }
     }
-		
-    for(const auto& t : task_ids_) {
-        if(dependent_tasks.find(t) == dependent_tasks.end()) {
-            task_queue_.push(ExecutionContext(t));
+    for(size_t i = 0; i < order.size(); i++) {
+        auto children = task_adj_list_.find(order[i]);
+        if(children == task_adj_list_.end()) {
+            continue;
+        }
+        for(const auto& next : children->second) {
+            if(--indegrees[next] == 0) {
+                order.emplace_back(next);
+            }
         }
     }
+    return order;
 }
 
 
@@ -64,9 +77,9 @@ bool JobScheduler<T>::EnforceLoadLimit() {
         std::cout << " -> nr_running_tasks = " << system_.NrRunningTasks() << std::endl;
     #endif
 	
-    while(system_.NrRunningTasks() > max_concurrent_tasks_) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        if(++cycles >= max_wait_cycles) {
+    // woken up as soon as a task completes
+    while(!system_.WaitForRunningTasks(max_concurrent_tasks_, std::chrono::milliseconds(100))) {
+        if(job_token_.IsCancelled() || ++cycles >= max_wait_cycles) {
             break;
         }
     }
@@ -94,6 +107,951 @@ void JobScheduler<T>::AddTask(uint32_t task_id, uint32_t depends_on_task_id) {
 }
 
 
+/// \brief Add all dependencies collected by a builder, as if AddTask was called
+///        for each of them. The dependencies are partitioned by (hashed) task id,
+///        the partitions build the graph data structures of their tasks in parallel
+///        (one per hardware thread, each built by its own thread), which are
+///        then spliced into the graph. Has to be called once the producers are done
+///        and before ProcessTasks.
+/// \param[in] The builder, which is empty afterwards
+/// \return None.
+template <class T>
+void JobScheduler<T>::AddTasks(GraphBuilder& builder) {
+    const std::vector<std::vector<graph_edge_t>> shards = builder.TakeEdges();
+    // more partitions than hardware threads only add threads contending for the cores
+    const uint32_t nr_partitions = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t nr_edges = 0;
+    for(const auto& shard : shards) {
+        nr_edges += shard.size();
+    }
+
+    // scatter: every thread distributes the edges of some shards to the partitions of
+    //  the task (by_task) and of the task it depends on (by_parent)
+    typedef std::vector<std::vector<graph_edge_t>> buckets_t;
+    std::vector<buckets_t> by_task(nr_partitions, buckets_t(nr_partitions));
+    std::vector<buckets_t> by_parent(nr_partitions, buckets_t(nr_partitions));
+    std::vector<std::future<void>> threads;
+    for(uint32_t i = 0; i < nr_partitions; i++) {
+        threads.emplace_back(std::async(std::launch::async,
+                                        [&shards, &by_task, &by_parent, nr_partitions, i]() {
+            for(size_t s = i; s < shards.size(); s += nr_partitions) {
+                for(const auto& edge : shards[s]) {
+                    by_task[i][GraphBuilder::Partition(edge.first, nr_partitions)].emplace_back(edge);
+                    by_parent[i][GraphBuilder::Partition(edge.second, nr_partitions)].emplace_back(edge);
+                }
+            }
+        }));
+    }
+    for(auto& thread : threads) {
+        thread.wait();
+    }
+    threads.clear();
+
+    // every partition builds the graph data structures of its own tasks
+    struct GraphPartition {
+        std::unordered_map<uint32_t, std::vector<uint32_t>> children;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> parents;
+        std::unordered_map<uint32_t, uint32_t> indegrees;
+        std::vector<uint32_t> ids; // ascending
+    };
+    std::vector<GraphPartition> partitions(nr_partitions);
+    for(uint32_t p = 0; p < nr_partitions; p++) {
+        threads.emplace_back(std::async(std::launch::async,
+                                        [&by_task, &by_parent, &partitions, nr_partitions, p]() {
+            GraphPartition& partition = partitions[p];
+            size_t nr_task_edges = 0;
+            size_t nr_parent_edges = 0;
+            for(uint32_t i = 0; i < nr_partitions; i++) {
+                nr_task_edges += by_task[i][p].size();
+                nr_parent_edges += by_parent[i][p].size();
+            }
+            partition.parents.reserve(nr_task_edges);
+            partition.indegrees.reserve(nr_task_edges);
+            partition.children.reserve(nr_parent_edges);
+            partition.ids.reserve(nr_task_edges + nr_parent_edges);
+
+            for(uint32_t i = 0; i < nr_partitions; i++) {
+                for(const auto& edge : by_task[i][p]) {
+                    partition.parents[edge.first].emplace_back(edge.second);
+                    partition.indegrees[edge.first]++;
+                    partition.ids.emplace_back(edge.first);
+                }
+                for(const auto& edge : by_parent[i][p]) {
+                    partition.children[edge.second].emplace_back(edge.first);
+                    partition.ids.emplace_back(edge.second);
+                }
+            }
+            std::sort(partition.ids.begin(), partition.ids.end());
+            partition.ids.erase(std::unique(partition.ids.begin(), partition.ids.end()),
+                                partition.ids.end());
+        }));
+    }
+    for(auto& thread : threads) {
+        thread.wait();
+    }
+    threads.clear();
+
+    // splice the nodes of the partitions into the graph, one thread per data structure.
+    //  tasks which exist already (added before) remain in the partition and are appended
+    threads.emplace_back(std::async(std::launch::async, [this, &partitions, nr_edges]() {
+        task_adj_list_.reserve(task_adj_list_.size() + nr_edges);
+        for(auto& partition : partitions) {
+            task_adj_list_.merge(partition.children);
+            for(const auto& existing : partition.children) {
+                std::vector<uint32_t>& children = task_adj_list_[existing.first];
+                children.insert(children.end(), existing.second.begin(), existing.second.end());
+            }
+        }
+    }));
+    threads.emplace_back(std::async(std::launch::async, [this, &partitions, nr_edges]() {
+        parent_tasks_.reserve(parent_tasks_.size() + nr_edges);
+        for(auto& partition : partitions) {
+            parent_tasks_.merge(partition.parents);
+            for(const auto& existing : partition.parents) {
+                std::vector<uint32_t>& parents = parent_tasks_[existing.first];
+                parents.insert(parents.end(), existing.second.begin(), existing.second.end());
+            }
+        }
+    }));
+    threads.emplace_back(std::async(std::launch::async, [this, &partitions, nr_edges]() {
+        indegrees_.reserve(indegrees_.size() + nr_edges);
+        for(auto& partition : partitions) {
+            indegrees_.merge(partition.indegrees);
+            for(const auto& existing : partition.indegrees) {
+                indegrees_[existing.first] += existing.second;
+            }
+        }
+    }));
+
+    // (on this thread) the ids of all partitions are merged in ascending order, which
+    //  appends them to the set without searching
+    typedef std::pair<uint32_t, uint32_t> next_id_t; // (id, partition)
+    std::priority_queue<next_id_t, std::vector<next_id_t>, std::greater<next_id_t>> next_ids;
+    std::vector<size_t> positions(nr_partitions, 0);
+    for(uint32_t p = 0; p < nr_partitions; p++) {
+        if(!partitions[p].ids.empty()) {
+            next_ids.emplace(partitions[p].ids[0], p);
+        }
+    }
+    while(!next_ids.empty()) {
+        next_id_t next = next_ids.top();
+        next_ids.pop();
+        task_ids_.emplace_hint(task_ids_.end(), next.first);
+        const std::vector<uint32_t>& ids = partitions[next.second].ids;
+        if(++positions[next.second] < ids.size()) {
+            next_ids.emplace(ids[positions[next.second]], next.second);
+        }
+    }
+
+    for(auto& thread : threads) {
+        thread.wait();
+    }
+}
+
+
+/// \brief Return the ids of all tasks of the graph (execution units, once compiled)
+/// \return Ids in ascending order
+template <class T>
+const std::set<uint32_t>& JobScheduler<T>::TaskIds() {
+    return task_ids_;
+}
+
+
+/// \brief Return the tasks depending on a given task
+/// \param[in] The id of the task
+/// \return List of task ids
+template <class T>
+std::vector<uint32_t> JobScheduler<T>::ChildTasks(uint32_t task_id) {
+    auto children = task_adj_list_.find(task_id);
+    return children == task_adj_list_.end() ? std::vector<uint32_t>() : children->second;
+}
+
+
+/// \brief Return the tasks a given task depends on
+/// \param[in] The id of the task
+/// \return List of task ids
+template <class T>
+std::vector<uint32_t> JobScheduler<T>::ParentTasks(uint32_t task_id) {
+    auto parents = parent_tasks_.find(task_id);
+    return parents == parent_tasks_.end() ? std::vector<uint32_t>() : parents->second;
+}
+
+
+/// \brief Return the number of dependencies of a given task
+/// \param[in] The id of the task
+/// \return Indegree of the task
+template <class T>
+uint32_t JobScheduler<T>::Indegree(uint32_t task_id) {
+    auto indegree = indegrees_.find(task_id);
+    return indegree == indegrees_.end() ? 0 : indegree->second;
+}
+
+
+/// \brief Replace the work performed for every task. The function is called with
+///        (sleep_time_sec, data), both set to the task id.
+/// \param[in] The work function
+/// \return None.
+template <class T>
+void JobScheduler<T>::SetWork(void_work_function_t work) {
+    work_ = [work](const uint32_t sleep_time_sec,
+                   const uint32_t data,
+                   const CancellationToken&) {
+        work(sleep_time_sec, data);
+    };
+}
+
+
+/// \brief Replace the work performed for every task by work which is handed the
+///        cancellation token of the task. Work should return early (e.g. throw
+///        TaskCancelled) once the token is cancelled.
+/// \param[in] The work function
+/// \return None.
+template <class T>
+void JobScheduler<T>::SetCancellableWork(cancellable_work_function_t work) {
+    work_ = work;
+}
+
+
+/// \brief Limit the duration of a task, measured from when it starts executing.
+///        A task running past its deadline is cancelled and counts as failed.
+/// \param[in] A unique id representing an execution/task
+/// \param[in] Maximum duration of the task
+/// \return None.
+template <class T>
+void JobScheduler<T>::SetTaskDeadline(uint32_t task_id, std::chrono::milliseconds timeout) {
+    task_timeouts_[task_id] = timeout;
+}
+
+
+/// \brief Limit the duration of the whole job, measured from ProcessTasks. Once
+///        passed, the job is cancelled.
+/// \param[in] Maximum duration of the job
+/// \return None.
+template <class T>
+void JobScheduler<T>::SetJobDeadline(std::chrono::milliseconds timeout) {
+    job_timeout_ = timeout;
+}
+
+
+/// \brief Cancel the job. Tasks not started yet are skipped, running tasks are
+///        asked to stop via their cancellation token.
+/// \return None.
+template <class T>
+void JobScheduler<T>::Cancel() {
+    *cancelled_ = true;
+}
+
+
+/// \brief Return a handle to wait for the job or to follow its progress. Note,
+///        ProcessTasks returns once all tasks are scheduled, not done.
+/// \return The handle of this job
+template <class T>
+JobHandle JobScheduler<T>::Handle() {
+    return JobHandle(completion_);
+}
+
+
+/// \brief Return the tasks which failed (threw an exception, were cancelled or
+///        ran past their deadline). A task which spawned a sub graph fails if a
+///        task of the sub graph fails.
+/// \return key: task id   value: the exception it failed with
+template <class T>
+std::unordered_map<uint32_t, std::exception_ptr> JobScheduler<T>::FailedTasks() {
+    // a continuation has a larger id than the unit it continues, which fails since the
+    //  continuation failed. the exception of the continuation is the original one
+    std::unordered_map<uint32_t, std::exception_ptr> failed_units = system_.FailedTasks();
+    std::map<uint32_t, std::exception_ptr> ordered(failed_units.begin(), failed_units.end());
+
+    std::unordered_map<uint32_t, std::exception_ptr> failed_tasks;
+    for(const auto& failed : ordered) {
+        failed_tasks[FailedTaskOf(failed.first)] = failed.second;
+    }
+    return failed_tasks;
+}
+
+
+/// \brief Return the tasks which were skipped since a task they depend on failed,
+///        or the job was cancelled before they started. This includes the tasks
+///        after a failed task within the same execution unit.
+/// \return Ids of the skipped tasks
+template <class T>
+std::set<uint32_t> JobScheduler<T>::SkippedTasks() {
+    std::set<uint32_t> skipped_tasks;
+    for(const auto unit_id : system_.SkippedTasks()) {
+        Continuation unit = ContinuedUnit(unit_id);
+        std::vector<uint32_t> tasks = UnitTasks(unit.unit_id);
+        for(uint32_t i = unit.position; i < tasks.size(); i++) {
+            skipped_tasks.insert(tasks[i]);
+        }
+    }
+
+    // the tasks of a failed execution unit after its failed task never ran
+    for(const auto& failed : system_.FailedTasks()) {
+        uint32_t unit_id = ContinuedUnit(failed.first).unit_id;
+        std::vector<uint32_t> tasks = UnitTasks(unit_id);
+        for(uint32_t i = UnitTaskPosition(unit_id) + 1; i < tasks.size(); i++) {
+            skipped_tasks.insert(tasks[i]);
+        }
+    }
+    return skipped_tasks;
+}
+
+
+/// \brief Return the task of a failed execution unit which failed
+/// \param[in] The id of the failed execution unit
+/// \return The id of the task
+template <class T>
+uint32_t JobScheduler<T>::FailedTaskOf(uint32_t failed_unit_id) {
+    // a continuation fails with a task of the unit it continues
+    uint32_t unit_id = ContinuedUnit(failed_unit_id).unit_id;
+    std::vector<uint32_t> tasks = UnitTasks(unit_id);
+    uint32_t position = UnitTaskPosition(unit_id);
+    if(position < tasks.size()) {
+        return tasks[position];
+    }
+
+    // all tasks of the unit ran, one of them spawned a sub graph which failed
+    MutexLocker lock(&task_positions_mutex_);
+    auto spawning_task = spawning_tasks_.find(unit_id);
+    return spawning_task == spawning_tasks_.end() ? tasks.back() : spawning_task->second;
+}
+
+
+/// \brief Record that an execution unit started one of its tasks
+/// \param[in] The id of the execution unit
+/// \param[in] Position of the task within the unit
+/// \return None.
+template <class T>
+void JobScheduler<T>::StartUnitTask(uint32_t unit_id, uint32_t position) {
+    MutexLocker lock(&task_positions_mutex_);
+    task_positions_[unit_id] = position;
+}
+
+
+/// \brief Return the position of the task an execution unit executes
+/// \param[in] The id of the execution unit
+/// \return Position of the task within the unit (0 if the unit did not start)
+template <class T>
+uint32_t JobScheduler<T>::UnitTaskPosition(uint32_t unit_id) {
+    MutexLocker lock(&task_positions_mutex_);
+    auto position = task_positions_.find(unit_id);
+    return position == task_positions_.end() ? 0 : position->second;
+}
+
+
+/// \brief Return the number of tasks of the job (before spawning any)
+/// \return Number of tasks
+template <class T>
+uint32_t JobScheduler<T>::NrTasks() {
+    uint32_t nr_tasks = 0;
+    for(const auto unit_id : task_ids_) {
+        nr_tasks += UnitTasks(unit_id).size();
+    }
+    return nr_tasks;
+}
+
+
+/// \brief Fork a sub graph from the work of a running task (fork-join). Every task
+///        of the sub graph becomes an execution unit of this job with a new id,
+///        scheduled on the same "System" once the tasks it depends on are done
+///        and fewer than "max_concurrent_tasks_" executions are working.
+///        The spawning task does not wait: its thread is released when its work
+///        returns, and it completes (releasing its dependents) together with the
+///        last unit of the sub graph. It fails if one of them fails. The tasks fused
+///        after the spawning task into its execution unit run as a continuation (a
+///        spawned unit as well) once the sub graph completed, and are skipped if it
+///        failed. Tasks of the sub graph may spawn further sub graphs. Not supported
+///        by worker processes.
+/// \param[in] The sub graph
+/// \return key: (local) id of a task of the sub graph   value: its execution unit id
+template <class T>
+std::unordered_map<uint32_t, uint32_t> JobScheduler<T>::Spawn(const SubGraph& sub_graph) {
+    int64_t spawning_unit = System::CurrentTask();
+    if(spawning_unit < 0) {
+        throw std::logic_error("Spawn has to be called from the work of a running task");
+    }
+
+    // Kahn's algorithm on the sub graph. a cycle would never complete the spawning unit
+    std::unordered_map<uint32_t, std::vector<uint32_t>> children;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> parents;
+    std::unordered_map<uint32_t, uint32_t> indegrees;
+    for(const auto& edge : sub_graph.Edges()) {
+        children[edge.second].emplace_back(edge.first);
+        parents[edge.first].emplace_back(edge.second);
+        indegrees[edge.first]++;
+    }
+    std::vector<uint32_t> order;
+    for(const auto& t : sub_graph.TaskIds()) {
+        if(indegrees[t] == 0) {
+            order.emplace_back(t);
+        }
+    }
+    for(size_t i = 0; i < order.size(); i++) {
+        for(const auto& c : children[order[i]]) {
+            if(--indegrees[c] == 0) {
+                order.emplace_back(c);
+            }
+        }
+    }
+    if(order.size() != sub_graph.TaskIds().size()) {
+        throw std::invalid_argument("Spawned sub graph has cyclic dependencies");
+    }
+
+    std::unordered_map<uint32_t, uint32_t> unit_ids;
+    std::vector<uint32_t> spawned;
+    for(const auto& t : order) {
+        unit_ids[t] = next_spawned_id_++;
+        spawned.emplace_back(unit_ids[t]);
+    }
+
+    // register the units before any of them can complete. (the spawning unit may be a
+    //  continuation, which runs tasks of the unit it continues)
+    const uint32_t continued_unit = ContinuedUnit(spawning_unit).unit_id;
+    std::vector<uint32_t> spawning_tasks = UnitTasks(continued_unit);
+    uint32_t position = std::min<uint32_t>(UnitTaskPosition(continued_unit),
+                                           spawning_tasks.size() - 1);
+    {
+        MutexLocker lock(&task_positions_mutex_);
+        spawning_tasks_[continued_unit] = spawning_tasks[position];
+    }
+    system_.AddChildren(spawning_unit, spawned);
+    completion_->AddTasks(spawned.size());
+
+    // spawned units are admitted like the units of the graph, once their parents are
+    //  completed and a slot is free. (their parents are completed at that point, so
+    //  they never hold a slot while waiting)
+    sub_graph_work_function_t work = sub_graph.Work();
+    {
+        MutexLocker lock(&spawn_mutex_);
+        for(const auto& t : order) {
+            SpawnedUnit& unit = spawned_units_[unit_ids[t]];
+            std::vector<uint32_t> parent_units;
+            for(const auto& p : parents[t]) {
+                parent_units.emplace_back(unit_ids[p]);
+            }
+            for(const auto& c : children[t]) {
+                unit.children.emplace_back(unit_ids[c]);
+            }
+            unit.nr_pending_parents = parent_units.size();
+            unit.parents = parent_units;
+
+            // units depending on a failed unit of the sub graph skip themselves
+            uint32_t unit_id = unit_ids[t];
+            unit.dispatch = [this, work, t, unit_id](const std::vector<uint32_t>& parents) {
+                ExecutionContext(unit_id, parents).Execute(
+                    [work, t](const CancellationToken& token) { work(t, token); },
+                    system_,
+                    job_token_,
+                    [](uint32_t) {});
+            };
+            if(unit.nr_pending_parents == 0) {
+                ready_spawned_units_.push_back(unit_id);
+            }
+        }
+
+        // the remaining tasks of the spawning unit join the sub graph: they depend on
+        //  all of its units, and on the work of the spawning unit (which stops after
+        //  the spawning task). further sub graphs spawned by that task join as well
+        if(position + 1 < spawning_tasks.size()) {
+            auto continuation = continuation_of_.find(spawning_unit);
+            if(continuation == continuation_of_.end()) {
+                uint32_t continuation_id = next_spawned_id_++;
+                continuation = continuation_of_.emplace(spawning_unit, continuation_id).first;
+                {
+                    MutexLocker positions_lock(&task_positions_mutex_);
+                    continuations_[continuation_id] = {continued_unit, position + 1};
+                }
+                system_.AddChildren(spawning_unit, {continuation_id});
+
+                SpawnedUnit& unit = spawned_units_[continuation_id];
+                unit.nr_pending_parents = 1;
+                unit.dispatch = [this, continuation_id, continued_unit, position]
+                                (const std::vector<uint32_t>& parents) {
+                    ExecutionContext(continuation_id, parents).Execute(
+                        CreateUnitWork(continued_unit,
+                                       [this, continuation_id, continued_unit]
+                                       (uint32_t task_position, deadline_t deadline) {
+                                           StartUnitTask(continued_unit, task_position);
+                                           system_.StartTask(continuation_id, deadline);
+                                       },
+                                       position + 1),
+                        system_,
+                        job_token_,
+                        [](uint32_t) {});
+                };
+            }
+
+            SpawnedUnit& unit = spawned_units_[continuation->second];
+            for(const auto spawned_id : spawned) {
+                spawned_units_[spawned_id].children.emplace_back(continuation->second);
+                unit.parents.emplace_back(spawned_id);
+                unit.nr_pending_parents++;
+            }
+        }
+    }
+    AdmitSpawnedUnits();
+    return unit_ids;
+}
+
+
+/// \brief Dispatch ready spawned execution units while fewer than
+///        "max_concurrent_tasks_" executions are working
+/// \return None.
+template <class T>
+void JobScheduler<T>::AdmitSpawnedUnits() {
+    MutexLocker lock(&spawn_mutex_);
+    const uint32_t max_working = std::max(max_concurrent_tasks_, 1u);
+    while(!ready_spawned_units_.empty() && system_.NrWorkingTasks() < max_working) {
+        uint32_t unit_id = ready_spawned_units_.front();
+        ready_spawned_units_.pop_front();
+
+        // it works from now on, its thread does not wait for its parents
+        system_.StartTask(unit_id, deadline_t::max());
+        SpawnedUnit& unit = spawned_units_[unit_id];
+        std::function<void(const std::vector<uint32_t>&)> dispatch = std::move(unit.dispatch);
+        dispatch(unit.parents);
+    }
+}
+
+
+/// \brief Release the spawned execution units depending on a completed unit
+/// \param[in] The id of the completed execution unit
+/// \return None.
+template <class T>
+void JobScheduler<T>::CompleteSpawnedUnit(uint32_t unit_id) {
+    {
+        MutexLocker lock(&spawn_mutex_);
+        auto unit = spawned_units_.find(unit_id);
+        if(unit == spawned_units_.end()) {
+            return;
+        }
+        for(const auto c : unit->second.children) {
+            // a skipped continuation is completed already
+            auto child = spawned_units_.find(c);
+            if(child != spawned_units_.end() && --child->second.nr_pending_parents == 0) {
+                ready_spawned_units_.push_back(c);
+            }
+        }
+        spawned_units_.erase(unit_id);
+    }
+    AdmitSpawnedUnits();
+}
+
+
+/// \brief Release the continuation of an execution unit whose work returned. It
+///        is skipped if the work failed.
+/// \param[in] The id of the execution unit
+/// \return None.
+template <class T>
+void JobScheduler<T>::ReleaseContinuation(uint32_t unit_id) {
+    bool failed = system_.IsFailed(unit_id);
+    uint32_t continuation_id;
+    {
+        MutexLocker lock(&spawn_mutex_);
+        auto continuation = continuation_of_.find(unit_id);
+        if(continuation == continuation_of_.end()) {
+            return;
+        }
+        continuation_id = continuation->second;
+        continuation_of_.erase(continuation);
+
+        if(!failed) {
+            if(--spawned_units_[continuation_id].nr_pending_parents == 0) {
+                ready_spawned_units_.push_back(continuation_id);
+            }
+            return;
+        }
+    }
+
+    // the remaining tasks never run. (completing it takes the lock, it releases nothing)
+    system_.SkipTask(continuation_id);
+    system_.CompleteTask(continuation_id);
+}
+
+
+/// \brief Check if the remaining tasks of an execution unit run as continuation,
+///        i.e., the unit has to stop after its current task
+/// \param[in] The id of the execution unit
+/// \return True if the unit has a continuation. False, otherwise
+template <class T>
+bool JobScheduler<T>::HasContinuation(int64_t unit_id) {
+    if(unit_id < 0) {
+        return false;
+    }
+    MutexLocker lock(&spawn_mutex_);
+    return continuation_of_.find(unit_id) != continuation_of_.end();
+}
+
+
+/// \brief Return the execution unit whose tasks a given execution unit runs: the
+///        unit continued by a continuation, the unit itself otherwise
+/// \param[in] The id of the execution unit
+/// \return The execution unit and the position of the first task run
+template <class T>
+typename JobScheduler<T>::Continuation JobScheduler<T>::ContinuedUnit(uint32_t unit_id) {
+    MutexLocker lock(&task_positions_mutex_);
+    auto continuation = continuations_.find(unit_id);
+    if(continuation == continuations_.end()) {
+        return {unit_id, 0};
+    }
+    return continuation->second;
+}
+
+
+/// \brief Return the first id after all task ids, including the tasks fused into
+///        execution units
+/// \return The id
+template <class T>
+uint32_t JobScheduler<T>::NextTaskId() {
+    int64_t max_id = task_ids_.empty() ? -1 : *task_ids_.rbegin();
+    for(const auto& unit : execution_units_) {
+        for(const auto task_id : unit.second) {
+            max_id = std::max<int64_t>(max_id, task_id);
+        }
+    }
+    return max_id + 1;
+}
+
+
+/// \brief Return the tasks executed by a given execution unit, in execution order.
+/// \param[in] The id of the execution unit
+/// \return List of task ids
+template <class T>
+std::vector<uint32_t> JobScheduler<T>::UnitTasks(uint32_t unit_id) {
+    auto unit = execution_units_.find(unit_id);
+    if(unit == execution_units_.end()) {
+        return {unit_id};
+    }
+    return unit->second;
+}
+
+
+/// \brief Create the function executing all tasks of an execution unit in order.
+///        Every task gets its own cancellation token, carrying its own deadline.
+///        It stops after a task which spawned a sub graph, the remaining tasks
+///        run as continuation (see Spawn).
+/// \param[in] The id of the execution unit
+/// \param[in] Called before each task starts (e.g. to track its deadline), and
+///            with the number of tasks once all of them are done
+/// \param[in] Position of the first task to execute
+/// \return A function, which performs the work of all tasks of the unit
+template <class T>
+context_work_function_t JobScheduler<T>::CreateUnitWork(uint32_t unit_id,
+                                                        task_start_function_t start_task,
+                                                        uint32_t first_position) {
+    std::vector<uint32_t> tasks = UnitTasks(unit_id);
+    std::vector<std::chrono::milliseconds> timeouts;
+    for(const auto task_id : tasks) {
+        auto task_timeout = task_timeouts_.find(task_id);
+        timeouts.emplace_back(task_timeout == task_timeouts_.end() ?
+                              std::chrono::milliseconds(0) : task_timeout->second);
+    }
+
+    cancellable_work_function_t work = work_;
+    return [this, tasks, timeouts, work, start_task, first_position]
+           (const CancellationToken& unit_token) -> void {
+        for(uint32_t i = first_position; i < tasks.size(); i++) {
+            // the deadline of a task is measured from its own start, not the unit's
+            deadline_t deadline = deadline_t::max();
+            if(timeouts[i].count() > 0) {
+                deadline = std::chrono::steady_clock::now() + timeouts[i];
+            }
+            CancellationToken token(unit_token, deadline);
+            start_task(i, token.Deadline());
+            unit_token.ThrowIfCancelled();
+
+            uint32_t sleep_time_sec = tasks[i];
+            uint32_t data = tasks[i];
+            work(sleep_time_sec, data, token);
+            // finishing after the deadline counts as a failure as well
+            token.ThrowIfCancelled();
+
+            // the task spawned a sub graph, which is joined before the remaining tasks
+            if(i + 1 < tasks.size() && HasContinuation(System::CurrentTask())) {
+                return;
+            }
+        }
+        start_task(tasks.size(), unit_token.Deadline());
+    };
+}
+
+
+/// \brief Skip all execution units depending (directly or transitively) on a
+///        failed or skipped execution unit. Units already skipped are not
+///        visited again, so the cost is linear in the size of the newly skipped cone.
+/// \param[in] The id of the failed or skipped execution unit
+/// \return None.
+template <class T>
+void JobScheduler<T>::SkipDependents(uint32_t unit_id) {
+    std::vector<uint32_t> cone;
+    std::vector<uint32_t> to_visit = {unit_id};
+
+    // note, the graph is not modified while tasks are running, it is safe to read it
+    //  from the threads of failing tasks
+    while(!to_visit.empty()) {
+        uint32_t t = to_visit.back();
+        to_visit.pop_back();
+
+        auto children = task_adj_list_.find(t);
+        if(children == task_adj_list_.end()) {
+            continue;
+        }
+        for(const auto c : children->second) {
+            if(system_.SkipTask(c)) {
+                cone.emplace_back(c);
+                to_visit.emplace_back(c);
+            }
+        }
+    }
+
+    #ifdef __DEBUG__
+        std::cout << "Skipped " << cone.size() << " tasks depending on #" << unit_id << std::endl;
+    #endif
+}
+
+
+/// \brief Skip and complete all execution units which have not been dispatched,
+///        e.g. once the job got cancelled.
+/// \return None.
+template <class T>
+void JobScheduler<T>::SkipUndispatched() {
+    for(const auto& t : task_ids_) {
+        if(!system_.IsDispatched(t)) {
+            system_.SkipTask(t);
+            system_.CompleteTask(t);
+        }
+    }
+}
+
+
+/// \brief Merge execution unit "absorbed" into execution unit "unit". The tasks of
+///        "absorbed" are appended to the tasks of "unit" and "absorbed" is removed
+///        from all graph data structures. Edges are not touched.
+/// \param[in] The id of the execution unit which remains
+/// \param[in] The id of the execution unit which is absorbed
+/// \return None.
+template <class T>
+void JobScheduler<T>::MergeUnits(uint32_t unit, uint32_t absorbed) {
+    std::vector<uint32_t> tasks = UnitTasks(unit);
+    for(const auto task_id : UnitTasks(absorbed)) {
+        tasks.emplace_back(task_id);
+    }
+    execution_units_[unit] = tasks;
+
+    execution_units_.erase(absorbed);
+    task_adj_list_.erase(absorbed);
+    parent_tasks_.erase(absorbed);
+    indegrees_.erase(absorbed);
+    task_ids_.erase(absorbed);
+}
+
+
+/// \brief Fuse linear chains, i.e., a task with a single child which itself has
+///        only that single parent, into one execution unit.
+/// \return Number of tasks absorbed into their parent.
+template <class T>
+uint32_t JobScheduler<T>::FuseLinearChains() {
+    uint32_t nr_fused = 0;
+    std::vector<uint32_t> task_ids(task_ids_.begin(), task_ids_.end());
+
+    for(const auto t : task_ids) {
+        // t may have been absorbed already by a unit visited earlier
+        if(task_ids_.find(t) == task_ids_.end()) {
+            continue;
+        }
+
+        // E.g., t -> c -> d  (c, d each with a single parent) becomes [t,c,d] -> ...
+        while(true) {
+            auto children = task_adj_list_.find(t);
+            if(children == task_adj_list_.end() || children->second.size() != 1) {
+                break;
+            }
+            uint32_t child = children->second.front();
+            if(child == t || parent_tasks_[child].size() != 1) {
+                break;
+            }
+
+            // the child's children now depend on t
+            std::vector<uint32_t> grand_children;
+            auto child_adj = task_adj_list_.find(child);
+            if(child_adj != task_adj_list_.end()) {
+                grand_children = child_adj->second;
+            }
+            for(const auto g : grand_children) {
+                std::replace(parent_tasks_[g].begin(), parent_tasks_[g].end(), child, t);
+            }
+
+            MergeUnits(t, child);
+            if(grand_children.empty()) {
+                task_adj_list_.erase(t);
+            } else {
+                task_adj_list_[t] = grand_children;
+            }
+            nr_fused++;
+        }
+    }
+    return nr_fused;
+}
+
+
+/// \brief Batch sibling tasks (same parents and same children) into groups of
+///        at most "grain_size" tasks which are executed by one execution unit.
+/// \param[in] Maximum number of siblings executed by one execution unit
+/// \return Number of tasks absorbed into a sibling.
+template <class T>
+uint32_t JobScheduler<T>::CoalesceSiblings(uint32_t grain_size) {
+    uint32_t nr_coalesced = 0;
+    if(grain_size < 2) {
+        return nr_coalesced;
+    }
+
+    // key: (sorted parents, sorted children)   value: the siblings sharing them
+    typedef std::pair<std::vector<uint32_t>, std::vector<uint32_t>> neighbours_t;
+    std::map<neighbours_t, std::vector<uint32_t>> siblings;
+
+    for(const auto t : task_ids_) {
+        neighbours_t key;
+        auto parents = parent_tasks_.find(t);
+        if(parents != parent_tasks_.end()) {
+            key.first = parents->second;
+        }
+        auto children = task_adj_list_.find(t);
+        if(children != task_adj_list_.end()) {
+            key.second = children->second;
+        }
+        std::sort(key.first.begin(), key.first.end());
+        std::sort(key.second.begin(), key.second.end());
+        siblings[key].emplace_back(t);
+    }
+
+    for(const auto& group : siblings) {
+        const std::vector<uint32_t>& members = group.second;
+
+        for(size_t i = 0; i < members.size(); i += grain_size) {
+            uint32_t unit = members[i];
+            for(size_t j = i + 1; j < std::min(members.size(), i + grain_size); j++) {
+                uint32_t absorbed = members[j];
+
+                // drop all edges of the absorbed sibling, "unit" carries the same edges.
+                //  (the current edges are used since earlier merges may have removed
+                //  some of the neighbours recorded in the key)
+                std::vector<uint32_t> parents = parent_tasks_[absorbed];
+                std::vector<uint32_t> children = task_adj_list_[absorbed];
+                for(const auto p : parents) {
+                    std::vector<uint32_t>& adj = task_adj_list_[p];
+                    adj.erase(std::find(adj.begin(), adj.end(), absorbed));
+                }
+                for(const auto c : children) {
+                    std::vector<uint32_t>& c_parents = parent_tasks_[c];
+                    c_parents.erase(std::find(c_parents.begin(), c_parents.end(), absorbed));
+                    indegrees_[c]--;
+                }
+
+                MergeUnits(unit, absorbed);
+                nr_coalesced++;
+            }
+        }
+    }
+    return nr_coalesced;
+}
+
+
+/// \brief Optimization pass over the graph built by AddTask. Linear chains are
+///        fused into a single execution unit and, if "grain_size" > 1, sibling
+///        tasks are batched into groups of up to "grain_size" tasks. Tasks inside
+///        a unit run in a valid topological order, so the observable order of side
+///        effects is preserved. Has to be called before ProcessTasks.
+/// \param[in] Maximum number of siblings executed by one execution unit
+/// \return Statistics on the number of execution units saved.
+template <class T>
+GraphCompileStats JobScheduler<T>::CompileGraph(uint32_t grain_size) {
+    GraphCompileStats stats;
+    stats.nr_tasks = task_ids_.size();
+    for(const auto& unit : execution_units_) {
+        stats.nr_tasks += unit.second.size() - 1;
+    }
+
+    stats.nr_fused = FuseLinearChains();
+    stats.nr_coalesced = CoalesceSiblings(grain_size);
+    if(stats.nr_coalesced > 0) {
+        // batching siblings may have turned fan-outs into new linear chains
+        stats.nr_fused += FuseLinearChains();
+    }
+
+    stats.nr_units = task_ids_.size();
+    return stats;
+}
+
+
+/// \brief Create a simulation of ProcessTasks on the current graph
+/// \param[in] Estimated cost of every task
+/// \return The simulator
+template <class T>
+Simulator JobScheduler<T>::CreateSimulator(task_cost_function_t task_cost) {
+    std::vector<uint32_t> order = DispatchOrder();
+    if(order.size() != task_ids_.size()) {
+        throw std::invalid_argument("Tasks with cyclic dependencies cannot be simulated");
+    }
+
+    std::unordered_map<uint32_t, uint32_t> positions;
+    positions.reserve(order.size());
+    for(uint32_t i = 0; i < order.size(); i++) {
+        positions[order[i]] = i;
+    }
+
+    std::vector<std::vector<uint32_t>> parents(order.size());
+    std::vector<double> costs(order.size(), 0);
+    for(uint32_t i = 0; i < order.size(); i++) {
+        auto unit_parents = parent_tasks_.find(order[i]);
+        if(unit_parents != parent_tasks_.end()) {
+            for(const auto& p : unit_parents->second) {
+                parents[i].emplace_back(positions.at(p));
+            }
+        }
+        for(const auto task_id : UnitTasks(order[i])) {
+            costs[i] += task_cost(task_id);
+        }
+    }
+    return Simulator(order, parents, costs);
+}
+
+
+/// \brief Limit the number of executions running at the same time
+/// \param[in] Maximum number of running executions/tasks
+/// \return None.
+template <class T>
+void JobScheduler<T>::SetMaxConcurrentTasks(uint32_t max_concurrent_tasks) {
+    max_concurrent_tasks_ = max_concurrent_tasks;
+}
+
+
+/// \brief Predict how ProcessTasks will behave, without executing any work. The
+///        graph (after CompileGraph, if called) is scheduled with the same dispatch
+///        order and load limit as ProcessTasks on a virtual clock, every execution
+///        unit taking the sum of the estimated costs of its tasks.
+/// \param[in] Estimated cost of every task (e.g. in seconds)
+/// \param[in] Number of cores of the simulated machine
+/// \return The predicted makespan, core utilization and critical path
+template <class T>
+SimulationReport JobScheduler<T>::Simulate(task_cost_function_t task_cost, uint32_t nr_cores) {
+    return CreateSimulator(task_cost).Run(max_concurrent_tasks_, nr_cores);
+}
+
+
+/// \brief Simulate ProcessTasks (see Simulate) for several limits of concurrent
+///        executions and recommend one. (to be applied via SetMaxConcurrentTasks)
+/// \param[in] Estimated cost of every task (e.g. in seconds)
+/// \param[in] Number of cores of the simulated machine
+/// \param[in] The limits to simulate
+/// \return A report per limit and the recommended limit
+template <class T>
+ConcurrencySweep JobScheduler<T>::SweepConcurrency(task_cost_function_t task_cost,
+                                                   uint32_t nr_cores,
+                                                   const std::vector<uint32_t>& candidates) {
+    return CreateSimulator(task_cost).Sweep(candidates, nr_cores);
+}
+
+
 /// \brief Helper function to print indegrees for all tasks
 /// \return None	
 template <class T>
@@ -109,42 +1067,212 @@ void JobScheduler<T>::PrintIndegrees() {
 ///         otherwise. (which is a sign that the system is constantly overloaded)
 template <class T>
 bool JobScheduler<T>::ProcessTasks() {
-    for(const auto& t : task_ids_) {
-        processed_tasks_[t] = false;
+    if(job_timeout_.count() > 0) {
+        job_token_ = CancellationToken(job_token_,
+                                       std::chrono::steady_clock::now() + job_timeout_);
     }
 
-    // get the tasks which are not dependent on any other tasks
-    // if this is empty we likely have some cyclic dependencies and cannot perform work
-    QueueUpIndependentTasks();
+    // spawned execution units are numbered after the tasks of the graph, including
+    //  the tasks absorbed by CompileGraph
+    next_spawned_id_ = NextTaskId();
+    completion_->Start(NrTasks());
 
-    while(!task_queue_.empty()) {
-        ExecutionContext processing = task_queue_.front();
-        task_queue_.pop();
+    // starts with the tasks which are not dependent on any other tasks. if some tasks
+    //  are missing, we have cyclic dependencies and cannot perform their work
+    std::vector<uint32_t> order = DispatchOrder();
 
+    for(const auto unit_id : order) {
         if(!EnforceLoadLimit()) {
+            // nothing else gets dispatched, running and waiting tasks stop as well
+            Cancel();
+            SkipUndispatched();
             std::cerr << "Tasks taking too long to finish. System overloaded. EXIT" << std::endl;
             return false;
         }
 
-        uint32_t task_id = processing.ExecutionId();
-    	uint32_t sleep_time_sec = task_id;
-    	uint32_t data = task_id;
-    	// schedule this task (note, this does not mean it will be executed right away.)
-    	processing.Execute(
-    	    std::bind(CreateWork(), sleep_time_sec, data),
-    	    system_);
+        if(job_token_.IsCancelled()) {
+            SkipUndispatched();
+            std::cerr << "Job cancelled or past its deadline. EXIT" << std::endl;
+            return false;
+        }
 
-        for(const auto& next : task_adj_list_[processing.ExecutionId()]) {
-            indegrees_[next]--;
-            if(!processed_tasks_.at(next) && indegrees_[next] == 0) {
-                task_queue_.push(ExecutionContext(next, parent_tasks_[next]));
-                processed_tasks_[next] = true;
-            }
+        // schedule all tasks of this execution unit (note, this does not mean it will
+        //  be executed right away.) units depending on a failed unit are not dispatched
+        if(system_.IsSkipped(unit_id)) {
+            system_.CompleteTask(unit_id);
+            continue;
         }
+
+        // (find, not operator[]: threads of failing tasks read the graph concurrently)
+        auto parents = parent_tasks_.find(unit_id);
+        ExecutionContext processing = parents == parent_tasks_.end() ?
+            ExecutionContext(unit_id) : ExecutionContext(unit_id, parents->second);
+        processing.Execute(
+            CreateUnitWork(unit_id, [this, unit_id](uint32_t position, deadline_t deadline) {
+                StartUnitTask(unit_id, position);
+                system_.StartTask(unit_id, deadline); }),
+            system_,
+            job_token_,
+            [this](uint32_t failed_unit_id) { SkipDependents(failed_unit_id); });
     }
 
+    if(order.size() != task_ids_.size()) {
+        // tasks on a cycle never reach an indegree of 0
+        SkipUndispatched();
+        std::cerr << "Tasks with cyclic dependencies cannot be scheduled. EXIT" << std::endl;
+        return false;
+    }
     return true;
 }
 
+/// \brief Run the job on "nr_workers" local worker processes instead of threads.
+///        The scheduler acts as coordinator: it runs Kahn's algorithm, sends ids of
+///        ready execution units to idle workers through shared memory rings and
+///        releases dependent units when the completions come back. Workers are
+///        forked, so side effects of tasks (e.g. on the global state) stay in the
+///        worker processes. Units are dispatched while no more than
+///        "max_concurrent_tasks_" are running (see EnforceLoadLimit).
+///        Only the calling thread exists in the forked workers, the work must not
+///        rely on other threads (or locks they hold). Returns once all tasks are
+///        done. A crashing worker fails its unit, the job continues on the remaining
+///        workers. The cancel flag of the job lives in memory shared with the workers,
+///        so Cancel() reaches running units. A worker running past the deadline of
+///        its task is killed and replaced, even if the task ignores its token.
+/// \param[in] Number of worker processes
+/// \return True if all tasks were executed (successfully or failed). False if
+///         the job got cancelled, no worker could be started or all workers died
+template <class T>
+bool JobScheduler<T>::ProcessTasksInWorkers(uint32_t nr_workers) {
+    if(job_timeout_.count() > 0) {
+        job_token_ = CancellationToken(job_token_,
+                                       std::chrono::steady_clock::now() + job_timeout_);
+    }
+    completion_->Start(NrTasks());
+
+    // executed inside the worker processes (on their copy of the scheduler)
+    WorkerPool pool(nr_workers);
+    bool started = pool.Start([this](uint32_t unit_id) {
+        CreateUnitWork(unit_id, [](uint32_t position, deadline_t deadline) {
+            WorkerPool::StartTask(position, deadline); })(job_token_);
+    });
+
+    // Kahn's algorithm on a copy of the indegrees. failed and skipped units release
+    //  their dependents as well, which then get skipped instead of dispatched
+    std::unordered_map<uint32_t, uint32_t> indegrees = indegrees_;
+    std::queue<uint32_t> ready;
+    for(const auto& t : task_ids_) {
+        if(indegrees[t] == 0) {
+            ready.push(t);
+        }
+    }
+
+    std::function<void(uint32_t)> release = [this, &indegrees, &ready](uint32_t unit_id) {
+        auto children = task_adj_list_.find(unit_id);
+        if(children == task_adj_list_.end()) {
+            return;
+        }
+        for(const auto& next : children->second) {
+            if(--indegrees[next] == 0) {
+                ready.push(next);
+            }
+        }
+    };
+    std::function<void(uint32_t, std::exception_ptr)> fail =
+        [this, &release](uint32_t unit_id, std::exception_ptr e) {
+        system_.FailTask(unit_id, e);
+        SkipDependents(unit_id);
+        system_.CompleteTask(unit_id);
+        release(unit_id);
+    };
+
+    uint32_t nr_resolved = 0;
+    uint32_t nr_in_flight = 0;
+    bool aborted = !started;
+    while(nr_resolved < task_ids_.size()) {
+        if(job_token_.IsCancelled() || (nr_in_flight == 0 && pool.NrAliveWorkers() == 0)) {
+            aborted = true;
+        }
+
+        // dispatch ready units to idle workers
+        while(!ready.empty()) {
+            uint32_t unit_id = ready.front();
+            if(aborted || system_.IsSkipped(unit_id)) {
+                ready.pop();
+                system_.SkipTask(unit_id);
+                system_.CompleteTask(unit_id);
+                release(unit_id);
+                nr_resolved++;
+                continue;
+            }
+            int32_t worker = pool.IdleWorker();
+            // same limit as EnforceLoadLimit (also makes progress with a limit of 0)
+            if(nr_in_flight > max_concurrent_tasks_ || worker < 0) {
+                break;
+            }
+            ready.pop();
+            if(!pool.Dispatch(worker, unit_id, job_token_.Deadline())) {
+                fail(unit_id, std::make_exception_ptr(
+                    std::runtime_error("cannot dispatch to worker process")));
+                nr_resolved++;
+                continue;
+            }
+            nr_in_flight++;
+        }
+        if(nr_resolved == task_ids_.size()) {
+            break;
+        }
+        if(ready.empty() && nr_in_flight == 0) {
+            // the remaining tasks are on a cycle and never reach an indegree of 0
+            for(const auto& t : task_ids_) {
+                if(indegrees[t] > 0) {
+                    system_.SkipTask(t);
+                    system_.CompleteTask(t);
+                }
+            }
+            std::cerr << "Tasks with cyclic dependencies cannot be scheduled. EXIT" << std::endl;
+            return false;
+        }
+
+        // completions flow back and drive the release of dependent units
+        TaskMessage msg;
+        if(pool.WaitForCompletion(msg, std::chrono::microseconds(1000))) {
+            nr_in_flight--;
+            nr_resolved++;
+            StartUnitTask(msg.unit_id, msg.task_position);
+            if(msg.status == TaskMessage::kDone) {
+                system_.CompleteTask(msg.unit_id);
+                release(msg.unit_id);
+            } else if(msg.status == TaskMessage::kCancelled) {
+                fail(msg.unit_id, std::make_exception_ptr(TaskCancelled(msg.error)));
+            } else {
+                fail(msg.unit_id, std::make_exception_ptr(std::runtime_error(msg.error)));
+            }
+            continue;
+        }
+
+        for(const auto& lost : pool.ReapDeadWorkers()) {
+            nr_in_flight--;
+            nr_resolved++;
+            StartUnitTask(lost.unit_id, lost.task_position);
+            fail(lost.unit_id, std::make_exception_ptr(std::runtime_error(lost.error)));
+        }
+
+        // tasks ignoring their token get a moment to notice the deadline themselves
+        for(const auto& overdue : pool.KillOverdueWorkers(std::chrono::milliseconds(10))) {
+            nr_in_flight--;
+            nr_resolved++;
+            StartUnitTask(overdue.unit_id, overdue.task_position);
+            fail(overdue.unit_id, std::make_exception_ptr(TaskCancelled(overdue.error)));
+        }
+    }
+
+    pool.Shutdown();
+    if(aborted) {
+        std::cerr << "Job cancelled or no worker process left. EXIT" << std::endl;
+    }
+    return !aborted;
+}
+
+
 // explicit instantiation(s) of JobScheduler
 template class JobScheduler<std::string>;
@@ -3,22 +3,55 @@
 
 #include <vector>
 #include <queue>
+#include <deque>
 #include <set>
+#include <map>
 #include <unordered_map>
 #include <string>
 #include <iostream>
 #include <chrono>
+#include <functional>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
 
 
 #include "State.h"
+#include "Cancellation.h"
 #include "ExecutionContext.h"
+#include "GraphBuilder.h"
+#include "JobHandle.h"
+#include "Simulator.h"
+#include "SubGraph.h"
 #include "System.h"
+#include "WorkerPool.h"
 
 
 // just one example of what type of work the job scheduler can create. here a simple
 //  function, which takes two integers. (plus the list of identifiers of preceding tasks)
 typedef std::function<void(const uint32_t, const uint32_t)> void_work_function_t;
 
+// same as void_work_function_t, plus a cancellation token the work is expected to check
+typedef std::function<void(const uint32_t, const uint32_t, const CancellationToken&)>
+    cancellable_work_function_t;
+
+// called whenever an execution unit starts one of its tasks, with (position of the task
+//  within the unit, deadline of the task). the position equals the number of tasks of
+//  the unit once all of them are done
+typedef std::function<void(const uint32_t, deadline_t)> task_start_function_t;
+
+
+/// \brief Summary of what the graph compilation pass (JobScheduler::CompileGraph) did.
+///        Every execution unit costs one ExecutionContext, one thread and one entry in
+///        the "System", so "nr_tasks - nr_units" is the per-task overhead saved.
+struct GraphCompileStats {
+    uint32_t nr_tasks = 0;     // tasks in the graph before compilation
+    uint32_t nr_units = 0;     // execution units scheduled after compilation
+    uint32_t nr_fused = 0;     // tasks absorbed into their single parent (linear chains)
+    uint32_t nr_coalesced = 0; // tasks batched together with their siblings
+};
+
 
 // A job consists of many tasks, which interdependencies are modeled via adjacency lists.
 //  Traversal/Scheduling using BFS. (Todo: exploit parallelism where possible)
@@ -36,7 +69,6 @@ class JobScheduler {
         uint32_t job_id_;
         uint32_t max_concurrent_tasks_;
         std::shared_ptr<GlobalState<T>> global_state_;
-        System system_;
 		
         // E.g., key: 0 ->  value: [1,2]  means that tasks 1 & 2 depend on task 0
         std::unordered_map<uint32_t, std::vector<uint32_t>> task_adj_list_;
@@ -47,23 +79,88 @@ class JobScheduler {
         // E.g., key: 0 -> value: 1  means that task 0 has an indegree of 1
         std::unordered_map<uint32_t, uint32_t> indegrees_;
 		
-        // Data structure to compute the topological sorting of tasks/ExecutionContexts
-        std::queue<ExecutionContext> task_queue_;
-        
         // manage a unique list of all the tasks
         std::set<uint32_t> task_ids_;
-		
-        // keep track of which tasks have already been processed
-        std::unordered_map<uint32_t, bool> processed_tasks_;
+
+        // E.g., key: 2 -> value: [2,5]  means that execution unit 2 runs task 2 and then
+        //  task 5 on the same thread. Created by CompileGraph(), tasks without an entry
+        //  are executed on their own.
+        std::unordered_map<uint32_t, std::vector<uint32_t>> execution_units_;
+
+        // the work performed for every task (defaults to CreateWork())
+        cancellable_work_function_t work_;
+
+        // the cancel flag of the job, set by Cancel(). created once (in memory shared
+        //  with worker processes), so cancelling never races with replacing the token
+        std::shared_ptr<std::atomic<bool>> cancelled_;
+
+        // shared by all tasks of this job, cancelled by Cancel() or the job deadline
+        CancellationToken job_token_;
+
+        // maximum duration of the whole job (zero means no limit)
+        std::chrono::milliseconds job_timeout_;
+
+        // E.g., key: 3 -> value: 500ms  means that task 3 fails if it runs longer than 500ms
+        std::unordered_map<uint32_t, std::chrono::milliseconds> task_timeouts_;
+
+        // id of the next execution unit spawned by a running task (see Spawn)
+        std::atomic<uint32_t> next_spawned_id_;
+
+        // E.g., key: 2 -> value: 1  means that execution unit 2 executes its second task.
+        //  (equals the number of tasks of the unit once all of them are done)
+        std::unordered_map<uint32_t, uint32_t> task_positions_ GUARDED_BY(task_positions_mutex_);
+
+        // E.g., key: 2 -> value: 5  means that task 5 of execution unit 2 spawned a sub graph
+        std::unordered_map<uint32_t, uint32_t> spawning_tasks_ GUARDED_BY(task_positions_mutex_);
+
+        // the remaining tasks of an execution unit, after one of its tasks spawned a sub graph
+        struct Continuation {
+            uint32_t unit_id;   // the execution unit continued
+            uint32_t position;  // position of its first remaining task
+        };
+        // key: id of the (spawned) execution unit running the continuation
+        std::unordered_map<uint32_t, Continuation> continuations_ GUARDED_BY(task_positions_mutex_);
+        Mutex task_positions_mutex_;
+
+        // a spawned execution unit which is not completed yet
+        struct SpawnedUnit {
+            uint32_t nr_pending_parents;   // within its sub graph
+            std::vector<uint32_t> parents;
+            std::vector<uint32_t> children;
+            std::function<void(const std::vector<uint32_t>&)> dispatch;  // called with parents
+        };
+        std::unordered_map<uint32_t, SpawnedUnit> spawned_units_ GUARDED_BY(spawn_mutex_);
+
+        // E.g., key: 2 -> value: 7  means that the remaining tasks of execution unit 2 run as
+        //  continuation 7, once the work of unit 2 returned (and its sub graphs completed)
+        std::unordered_map<uint32_t, uint32_t> continuation_of_ GUARDED_BY(spawn_mutex_);
+
+        // spawned units whose parents are completed, waiting for a free slot
+        std::deque<uint32_t> ready_spawned_units_ GUARDED_BY(spawn_mutex_);
+        Mutex spawn_mutex_;
+
+        // counts completed tasks, shared with all handles of this job
+        std::shared_ptr<JobCompletion> completion_;
+
+        // declared last: tasks still running when the scheduler is destroyed access the
+        //  graph (to skip dependents of failed tasks), "System" waits for them first
+        System system_;
 
         /// \brief Simple representation of work being performed on some state.
         /// \return A function, which operates on some state
-        void_work_function_t CreateWork();
+        cancellable_work_function_t CreateWork();
 
-        /// \brief Find initial tasks with indegree of 0. These are the starting points of
-        ///        the overall scheduling algorithm.
-        /// \return None.
-        void QueueUpIndependentTasks();
+        /// \brief Kahn's algorithm (BFS) over the graph, starting with the tasks which do not
+        ///        depend on any other task. This is the order in which ProcessTasks dispatches
+        ///        the execution units. Tasks on a cycle never reach an indegree of 0 and are
+        ///        missing from the order.
+        /// \return Ids of the execution units in dispatch order
+        std::vector<uint32_t> DispatchOrder();
+
+        /// \brief Create a simulation of ProcessTasks on the current graph
+        /// \param[in] Estimated cost of every task
+        /// \return The simulator
+        Simulator CreateSimulator(task_cost_function_t task_cost);
 
         /// \brief Ensure no more than "max_concurrent_tasks_" many executions are running
         ///        at the same time. we consult the compute "System" for this information.
@@ -72,11 +169,141 @@ class JobScheduler {
         /// \return None.
         bool EnforceLoadLimit();
 
+        /// \brief Dispatch ready spawned execution units while fewer than
+        ///        "max_concurrent_tasks_" executions are working
+        /// \return None.
+        void AdmitSpawnedUnits();
+
+        /// \brief Release the spawned execution units depending on a completed unit
+        /// \param[in] The id of the completed execution unit
+        /// \return None.
+        void CompleteSpawnedUnit(uint32_t unit_id);
+
+        /// \brief Release the continuation of an execution unit whose work returned. It
+        ///        is skipped if the work failed.
+        /// \param[in] The id of the execution unit
+        /// \return None.
+        void ReleaseContinuation(uint32_t unit_id);
+
+        /// \brief Check if the remaining tasks of an execution unit run as continuation,
+        ///        i.e., the unit has to stop after its current task
+        /// \param[in] The id of the execution unit
+        /// \return True if the unit has a continuation. False, otherwise
+        bool HasContinuation(int64_t unit_id);
+
+        /// \brief Return the execution unit whose tasks a given execution unit runs: the
+        ///        unit continued by a continuation, the unit itself otherwise
+        /// \param[in] The id of the execution unit
+        /// \return The execution unit and the position of the first task run
+        Continuation ContinuedUnit(uint32_t unit_id);
+
+        /// \brief Return the first id after all task ids, including the tasks fused into
+        ///        execution units
+        /// \return The id
+        uint32_t NextTaskId();
+
+        /// \brief Return the task of a failed execution unit which failed
+        /// \param[in] The id of the failed execution unit
+        /// \return The id of the task
+        uint32_t FailedTaskOf(uint32_t unit_id);
+
+        /// \brief Record that an execution unit started one of its tasks
+        /// \param[in] The id of the execution unit
+        /// \param[in] Position of the task within the unit
+        /// \return None.
+        void StartUnitTask(uint32_t unit_id, uint32_t position);
+
+        /// \brief Return the position of the task an execution unit executes
+        /// \param[in] The id of the execution unit
+        /// \return Position of the task within the unit (0 if the unit did not start)
+        uint32_t UnitTaskPosition(uint32_t unit_id);
+
+        /// \brief Return the number of tasks of the job (before spawning any)
+        /// \return Number of tasks
+        uint32_t NrTasks();
+
+        /// \brief Return the tasks executed by a given execution unit, in execution order.
+        /// \param[in] The id of the execution unit
+        /// \return List of task ids
+        std::vector<uint32_t> UnitTasks(uint32_t unit_id);
+
+        /// \brief Create the function executing all tasks of an execution unit in order.
+        ///        Every task gets its own cancellation token, carrying its own deadline.
+        ///        It stops after a task which spawned a sub graph, the remaining tasks
+        ///        run as continuation (see Spawn).
+        /// \param[in] The id of the execution unit
+        /// \param[in] Called before each task starts (e.g. to track its deadline), and
+        ///            with the number of tasks once all of them are done
+        /// \param[in] Position of the first task to execute
+        /// \return A function, which performs the work of all tasks of the unit
+        context_work_function_t CreateUnitWork(uint32_t unit_id, task_start_function_t start_task,
+                                               uint32_t first_position = 0);
+
+        /// \brief Skip all execution units depending (directly or transitively) on a
+        ///        failed or skipped execution unit. Units already skipped are not
+        ///        visited again, so the cost is linear in the size of the newly skipped cone.
+        /// \param[in] The id of the failed or skipped execution unit
+        /// \return None.
+        void SkipDependents(uint32_t unit_id);
+
+        /// \brief Skip and complete all execution units which have not been dispatched,
+        ///        e.g. once the job got cancelled.
+        /// \return None.
+        void SkipUndispatched();
+
+        /// \brief Merge execution unit "absorbed" into execution unit "unit". The tasks of
+        ///        "absorbed" are appended to the tasks of "unit" and "absorbed" is removed
+        ///        from all graph data structures. Edges are not touched.
+        /// \param[in] The id of the execution unit which remains
+        /// \param[in] The id of the execution unit which is absorbed
+        /// \return None.
+        void MergeUnits(uint32_t unit, uint32_t absorbed);
+
+        /// \brief Fuse linear chains, i.e., a task with a single child which itself has
+        ///        only that single parent, into one execution unit.
+        /// \return Number of tasks absorbed into their parent.
+        uint32_t FuseLinearChains();
+
+        /// \brief Batch sibling tasks (same parents and same children) into groups of
+        ///        at most "grain_size" tasks which are executed by one execution unit.
+        /// \param[in] Maximum number of siblings executed by one execution unit
+        /// \return Number of tasks absorbed into a sibling.
+        uint32_t CoalesceSiblings(uint32_t grain_size);
+
     public:
         JobScheduler(std::shared_ptr<GlobalState<T>> global_state) :
             global_state_(global_state) {
             job_id_ = 1234;
             max_concurrent_tasks_ = 4;
+            job_timeout_ = std::chrono::milliseconds(0);
+            next_spawned_id_ = 0;
+            work_ = CreateWork();
+
+            // worker processes (see ProcessTasksInWorkers) inherit the cancel flag
+            cancelled_ = WorkerPool::SharedFlag(false);
+            if(cancelled_ == nullptr) {
+                cancelled_ = std::make_shared<std::atomic<bool>>(false);
+            }
+            job_token_ = CancellationToken(cancelled_, deadline_t::max());
+
+            // progress is reported per task, also for tasks fused into one execution unit
+            completion_ = std::make_shared<JobCompletion>();
+            std::shared_ptr<JobCompletion> completion = completion_;
+            system_.OnTaskComplete([this, completion](uint32_t unit_id) {
+                CompleteSpawnedUnit(unit_id);
+                // the tasks of a continuation complete with the unit it continues
+                if(ContinuedUnit(unit_id).unit_id != unit_id) {
+                    return;
+                }
+                for(const auto task_id : UnitTasks(unit_id)) {
+                    completion->Complete(task_id);
+                }
+            });
+            // a slot got free
+            system_.OnTaskFinish([this](uint32_t unit_id) {
+                ReleaseContinuation(unit_id);
+                AdmitSpawnedUnits();
+            });
         }
 
         /// \brief Represent dependencies among tasks/executions via adjacency list and
@@ -88,6 +315,146 @@ class JobScheduler {
         void AddTask(uint32_t task_id,
                      uint32_t depends_on_task_id);
 
+        /// \brief Add all dependencies collected by a builder, as if AddTask was called
+        ///        for each of them. The dependencies are partitioned by (hashed) task id,
+        ///        the partitions build the graph data structures of their tasks in parallel
+        ///        (one per hardware thread, each built by its own thread), which are
+        ///        then spliced into the graph. Has to be called once the producers are done
+        ///        and before ProcessTasks.
+        /// \param[in] The builder, which is empty afterwards
+        /// \return None.
+        void AddTasks(GraphBuilder& builder);
+
+        /// \brief Return the ids of all tasks of the graph (execution units, once compiled)
+        /// \return Ids in ascending order
+        const std::set<uint32_t>& TaskIds();
+
+        /// \brief Return the tasks depending on a given task
+        /// \param[in] The id of the task
+        /// \return List of task ids
+        std::vector<uint32_t> ChildTasks(uint32_t task_id);
+
+        /// \brief Return the tasks a given task depends on
+        /// \param[in] The id of the task
+        /// \return List of task ids
+        std::vector<uint32_t> ParentTasks(uint32_t task_id);
+
+        /// \brief Return the number of dependencies of a given task
+        /// \param[in] The id of the task
+        /// \return Indegree of the task
+        uint32_t Indegree(uint32_t task_id);
+
+        /// \brief Replace the work performed for every task. The function is called with
+        ///        (sleep_time_sec, data), both set to the task id.
+        /// \param[in] The work function
+        /// \return None.
+        void SetWork(void_work_function_t work);
+
+        /// \brief Replace the work performed for every task by work which is handed the
+        ///        cancellation token of the task. Work should return early (e.g. throw
+        ///        TaskCancelled) once the token is cancelled.
+        /// \param[in] The work function
+        /// \return None.
+        void SetCancellableWork(cancellable_work_function_t work);
+
+        /// \brief Limit the duration of a task, measured from when it starts executing.
+        ///        A task running past its deadline is cancelled and counts as failed.
+        /// \param[in] A unique id representing an execution/task
+        /// \param[in] Maximum duration of the task
+        /// \return None.
+        void SetTaskDeadline(uint32_t task_id, std::chrono::milliseconds timeout);
+
+        /// \brief Limit the duration of the whole job, measured from ProcessTasks. Once
+        ///        passed, the job is cancelled.
+        /// \param[in] Maximum duration of the job
+        /// \return None.
+        void SetJobDeadline(std::chrono::milliseconds timeout);
+
+        /// \brief Cancel the job. Tasks not started yet are skipped, running tasks are
+        ///        asked to stop via their cancellation token.
+        /// \return None.
+        void Cancel();
+
+        /// \brief Fork a sub graph from the work of a running task (fork-join). Every task
+        ///        of the sub graph becomes an execution unit of this job with a new id,
+        ///        scheduled on the same "System" once the tasks it depends on are done
+        ///        and fewer than "max_concurrent_tasks_" executions are working.
+        ///        The spawning task does not wait: its thread is released when its work
+        ///        returns, and it completes (releasing its dependents) together with the
+        ///        last unit of the sub graph. It fails if one of them fails. Tasks of the
+        ///        sub graph may spawn further sub graphs. Not supported by worker processes.
+        /// \param[in] The sub graph
+        /// \return key: (local) id of a task of the sub graph   value: its execution unit id
+        std::unordered_map<uint32_t, uint32_t> Spawn(const SubGraph& sub_graph);
+
+        /// \brief Run the job on "nr_workers" local worker processes instead of threads.
+        ///        The scheduler acts as coordinator: it runs Kahn's algorithm, sends ids of
+        ///        ready execution units to idle workers through shared memory rings and
+        ///        releases dependent units when the completions come back. Workers are
+        ///        forked, so side effects of tasks (e.g. on the global state) stay in the
+        ///        worker processes. Units are dispatched while no more than
+        ///        "max_concurrent_tasks_" are running (see EnforceLoadLimit).
+        ///        Only the calling thread exists in the forked workers, the work must not
+        ///        rely on other threads (or locks they hold). Returns once all tasks are
+        ///        done. A crashing worker fails its unit, the job continues on the remaining
+        ///        workers. The cancel flag of the job lives in memory shared with the workers,
+        ///        so Cancel() reaches running units. A worker running past the deadline of
+        ///        its task is killed and replaced, even if the task ignores its token.
+        /// \param[in] Number of worker processes
+        /// \return True if all tasks were executed (successfully or failed). False if
+        ///         the job got cancelled, no worker could be started or all workers died
+        bool ProcessTasksInWorkers(uint32_t nr_workers);
+
+        /// \brief Return a handle to wait for the job or to follow its progress. Note,
+        ///        ProcessTasks returns once all tasks are scheduled, not done.
+        /// \return The handle of this job
+        JobHandle Handle();
+
+        /// \brief Return the tasks which failed (threw an exception, were cancelled or
+        ///        ran past their deadline). A task which spawned a sub graph fails if a
+        ///        task of the sub graph fails.
+        /// \return key: task id   value: the exception it failed with
+        std::unordered_map<uint32_t, std::exception_ptr> FailedTasks();
+
+        /// \brief Return the tasks which were skipped since a task they depend on failed,
+        ///        or the job was cancelled before they started. This includes the tasks
+        ///        after a failed task within the same execution unit.
+        /// \return Ids of the skipped tasks
+        std::set<uint32_t> SkippedTasks();
+
+        /// \brief Optimization pass over the graph built by AddTask. Linear chains are
+        ///        fused into a single execution unit and, if "grain_size" > 1, sibling
+        ///        tasks are batched into groups of up to "grain_size" tasks. Tasks inside
+        ///        a unit run in a valid topological order, so the observable order of side
+        ///        effects is preserved. Has to be called before ProcessTasks.
+        /// \param[in] Maximum number of siblings executed by one execution unit
+        /// \return Statistics on the number of execution units saved.
+        GraphCompileStats CompileGraph(uint32_t grain_size = 1);
+
+        /// \brief Limit the number of executions running at the same time
+        /// \param[in] Maximum number of running executions/tasks
+        /// \return None.
+        void SetMaxConcurrentTasks(uint32_t max_concurrent_tasks);
+
+        /// \brief Predict how ProcessTasks will behave, without executing any work. The
+        ///        graph (after CompileGraph, if called) is scheduled with the same dispatch
+        ///        order and load limit as ProcessTasks on a virtual clock, every execution
+        ///        unit taking the sum of the estimated costs of its tasks.
+        /// \param[in] Estimated cost of every task (e.g. in seconds)
+        /// \param[in] Number of cores of the simulated machine
+        /// \return The predicted makespan, core utilization and critical path
+        SimulationReport Simulate(task_cost_function_t task_cost, uint32_t nr_cores);
+
+        /// \brief Simulate ProcessTasks (see Simulate) for several limits of concurrent
+        ///        executions and recommend one. (to be applied via SetMaxConcurrentTasks)
+        /// \param[in] Estimated cost of every task (e.g. in seconds)
+        /// \param[in] Number of cores of the simulated machine
+        /// \param[in] The limits to simulate
+        /// \return A report per limit and the recommended limit
+        ConcurrencySweep SweepConcurrency(task_cost_function_t task_cost,
+                                          uint32_t nr_cores,
+                                          const std::vector<uint32_t>& candidates);
+
         /// \brief Helper function to print indegrees for all tasks
         /// \return None
         void PrintIndegrees();
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/// \brief Lock-free ring buffer for exactly one producer and one consumer. It does not
+///        own any memory and can be placed in memory shared between processes (e.g. a
+///        MAP_SHARED mapping created before fork), since lock-free atomics do not
+///        depend on the address space they live in.
+/// \param[in] Msg trivially copyable message type
+/// \param[in] Capacity maximum number of queued messages
+template <class Msg, uint32_t Capacity>
+class SpscRing {
+    private:
+        static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                      "shared memory rings require lock-free 64 bit atomics");
+
+        // producer and consumer positions live on different cache lines
+        alignas(64) std::atomic<uint64_t> head_; // next message to read
+        alignas(64) std::atomic<uint64_t> tail_; // next slot to write
+        alignas(64) Msg slots_[Capacity];
+
+    public:
+        /// \brief Reset an (uninitialized) ring to empty. Has to be called before the
+        ///        ring is shared.
+        /// \return None
+        void Init() {
+            head_.store(0, std::memory_order_relaxed);
+            tail_.store(0, std::memory_order_relaxed);
+        }
+
+        /// \brief Append a message. Must only be called by the producer.
+        /// \param[in] The message
+        /// \return True if the message was queued. False if the ring is full
+        bool TryPush(const Msg& msg) {
+            uint64_t tail = tail_.load(std::memory_order_relaxed);
+            if(tail - head_.load(std::memory_order_acquire) == Capacity) {
+                return false;
+            }
+            slots_[tail % Capacity] = msg;
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /// \brief Check if the ring is empty. Must only be called by the consumer.
+        /// \return True if there is no message. False, otherwise
+        bool Empty() const {
+            return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+        }
+
+        /// \brief Remove the oldest message. Must only be called by the consumer.
+        /// \param[out] The message
+        /// \return True if a message was removed. False if the ring is empty
+        bool TryPop(Msg& msg) {
+            uint64_t head = head_.load(std::memory_order_relaxed);
+            if(head == tail_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            msg = slots_[head % Capacity];
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+};
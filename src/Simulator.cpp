@@ -0,0 +1,174 @@
+
+#include "Simulator.h"
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <utility>
+
+
+/// \brief Set up the simulation of a job
+/// \param[in] Ids of the execution units in dispatch order, which has to be a
+///            topological order
+/// \param[in] Parents of every unit, as positions in the dispatch order
+/// \param[in] Estimated cost of every unit
+Simulator::Simulator(const std::vector<uint32_t>& unit_ids,
+                     const std::vector<std::vector<uint32_t>>& parents,
+                     const std::vector<double>& costs) :
+    unit_ids_(unit_ids),
+    costs_(costs),
+    nr_parents_(unit_ids.size(), 0),
+    child_offsets_(unit_ids.size() + 1, 0),
+    critical_path_length_(0) {
+
+    // compressed child lists: count, prefix sum, fill
+    for(uint32_t i = 0; i < parents.size(); i++) {
+        nr_parents_[i] = parents[i].size();
+        for(const auto p : parents[i]) {
+            child_offsets_[p + 1]++;
+        }
+    }
+    for(uint32_t i = 0; i < unit_ids_.size(); i++) {
+        child_offsets_[i + 1] += child_offsets_[i];
+    }
+    child_units_.resize(child_offsets_.back());
+    std::vector<uint32_t> fill(child_offsets_.begin(), child_offsets_.end() - 1);
+    for(uint32_t i = 0; i < parents.size(); i++) {
+        for(const auto p : parents[i]) {
+            child_units_[fill[p]++] = i;
+        }
+    }
+
+    ComputeCriticalPath(parents);
+}
+
+
+/// \brief Compute the longest path (by cost) through the graph
+/// \param[in] Parents of every unit, as positions in the dispatch order
+/// \return None
+void Simulator::ComputeCriticalPath(const std::vector<std::vector<uint32_t>>& parents) {
+    // the dispatch order is topological, parents are finished before their children
+    const int64_t none = -1;
+    std::vector<double> finish(unit_ids_.size(), 0);
+    std::vector<int64_t> predecessor(unit_ids_.size(), none);
+    int64_t last = none;
+
+    for(uint32_t i = 0; i < unit_ids_.size(); i++) {
+        double start = 0;
+        for(const auto p : parents[i]) {
+            if(predecessor[i] == none || finish[p] > start) {
+                start = finish[p];
+                predecessor[i] = p;
+            }
+        }
+        finish[i] = start + costs_[i];
+        if(last == none || finish[i] > finish[last]) {
+            last = i;
+        }
+    }
+
+    for(int64_t i = last; i != none; i = predecessor[i]) {
+        critical_path_.emplace_back(unit_ids_[i]);
+    }
+    std::reverse(critical_path_.begin(), critical_path_.end());
+    critical_path_length_ = last == none ? 0 : finish[last];
+}
+
+
+/// \brief Simulate the job
+/// \param[in] Maximum number of running units the scheduler waits for before
+///            dispatching the next one
+/// \param[in] Number of cores of the simulated machine
+/// \return The predicted makespan, utilization and critical path
+SimulationReport Simulator::Run(uint32_t max_concurrent_tasks, uint32_t nr_cores) const {
+    typedef std::pair<double, uint32_t> event_t; // (finish time, unit position)
+    std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t>> finish_events;
+    std::deque<uint32_t> waiting_for_core;
+
+    const uint32_t nr_units = unit_ids_.size();
+    std::vector<uint32_t> pending_parents = nr_parents_;
+    std::vector<bool> dispatched(nr_units, false);
+    uint32_t next = 0;
+    uint32_t nr_in_flight = 0;
+    uint32_t idle_cores = std::max(nr_cores, 1u);
+    double now = 0;
+
+    SimulationReport report;
+    report.max_concurrent_tasks = max_concurrent_tasks;
+    report.nr_cores = idle_cores;
+    report.critical_path_length = critical_path_length_;
+    report.critical_path = critical_path_;
+
+    while(true) {
+        // same check as JobScheduler::EnforceLoadLimit: dispatch the next unit once at
+        //  most "max_concurrent_tasks" units are running
+        while(next < nr_units && nr_in_flight <= max_concurrent_tasks) {
+            dispatched[next] = true;
+            nr_in_flight++;
+            if(pending_parents[next] == 0) {
+                waiting_for_core.push_back(next);
+            }
+            next++;
+        }
+
+        while(idle_cores > 0 && !waiting_for_core.empty()) {
+            uint32_t unit = waiting_for_core.front();
+            waiting_for_core.pop_front();
+            idle_cores--;
+            report.busy_time += costs_[unit];
+            finish_events.emplace(now + costs_[unit], unit);
+        }
+
+        // the earliest dispatched unit which is not done always has all of its parents
+        //  done (the order is topological), so there is an event unless all units are done
+        if(finish_events.empty()) {
+            break;
+        }
+        event_t event = finish_events.top();
+        finish_events.pop();
+        now = event.first;
+        idle_cores++;
+        nr_in_flight--;
+
+        for(uint32_t c = child_offsets_[event.second]; c < child_offsets_[event.second + 1]; c++) {
+            uint32_t child = child_units_[c];
+            if(--pending_parents[child] == 0 && dispatched[child]) {
+                waiting_for_core.push_back(child);
+            }
+        }
+    }
+
+    report.makespan = now;
+    if(now > 0) {
+        report.utilization = report.busy_time / (now * report.nr_cores);
+    }
+    return report;
+}
+
+
+/// \brief Simulate the job for several "max_concurrent_tasks" values
+/// \param[in] The values to simulate
+/// \param[in] Number of cores of the simulated machine
+/// \return A report per value and the recommended value
+ConcurrencySweep Simulator::Sweep(const std::vector<uint32_t>& candidates,
+                                  uint32_t nr_cores) const {
+    ConcurrencySweep sweep;
+    double best_makespan = 0;
+    for(const auto max_concurrent_tasks : candidates) {
+        sweep.reports.emplace_back(Run(max_concurrent_tasks, nr_cores));
+        if(sweep.reports.size() == 1 || sweep.reports.back().makespan < best_makespan) {
+            best_makespan = sweep.reports.back().makespan;
+        }
+    }
+
+    bool recommended = false;
+    for(const auto& report : sweep.reports) {
+        if(report.makespan <= best_makespan * 1.05 &&
+           (!recommended ||
+            report.max_concurrent_tasks < sweep.recommended_max_concurrent_tasks)) {
+            sweep.recommended_max_concurrent_tasks = report.max_concurrent_tasks;
+            recommended = true;
+        }
+    }
+    return sweep;
+}
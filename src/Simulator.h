@@ -0,0 +1,77 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+// estimated cost (e.g. in seconds) of a task, called with the task id
+typedef std::function<double(const uint32_t)> task_cost_function_t;
+
+
+/// \brief Predicted behavior of a job (see Simulator::Run)
+struct SimulationReport {
+    uint32_t max_concurrent_tasks = 0;
+    uint32_t nr_cores = 0;
+    double makespan = 0;             // time until all execution units are done
+    double busy_time = 0;            // sum of the costs of all execution units
+    double utilization = 0;          // busy_time / (makespan * nr_cores)
+    double critical_path_length = 0; // lower bound of the makespan on any machine
+    std::vector<uint32_t> critical_path; // execution units on the longest path, in order
+};
+
+
+/// \brief Result of simulating a job with different "max_concurrent_tasks" values
+struct ConcurrencySweep {
+    std::vector<SimulationReport> reports;
+    // smallest value whose makespan is within 5% of the best one (fewer threads for
+    //  (almost) the same makespan)
+    uint32_t recommended_max_concurrent_tasks = 0;
+};
+
+
+/// \brief Discrete-event simulation of the scheduling policy of JobScheduler::ProcessTasks
+///        on a virtual clock. Execution units are dispatched in the given order, as long
+///        as at most "max_concurrent_tasks" dispatched units are not done. A dispatched
+///        unit holds its slot while waiting for its parents, and needs one of "nr_cores"
+///        cores (first come, first served) while executing for its estimated cost.
+///        Cost per event is O(log n), so jobs with millions of tasks simulate in seconds.
+class Simulator {
+    private:
+        std::vector<uint32_t> unit_ids_;
+        std::vector<double> costs_;
+        std::vector<uint32_t> nr_parents_;
+
+        // children of the unit at position i: child_units_[child_offsets_[i] .. child_offsets_[i + 1]]
+        std::vector<uint32_t> child_offsets_;
+        std::vector<uint32_t> child_units_;
+
+        double critical_path_length_;
+        std::vector<uint32_t> critical_path_;
+
+        /// \brief Compute the longest path (by cost) through the graph
+        /// \param[in] Parents of every unit, as positions in the dispatch order
+        /// \return None
+        void ComputeCriticalPath(const std::vector<std::vector<uint32_t>>& parents);
+
+    public:
+        /// \brief Set up the simulation of a job
+        /// \param[in] Ids of the execution units in dispatch order, which has to be a
+        ///            topological order
+        /// \param[in] Parents of every unit, as positions in the dispatch order
+        /// \param[in] Estimated cost of every unit
+        Simulator(const std::vector<uint32_t>& unit_ids,
+                  const std::vector<std::vector<uint32_t>>& parents,
+                  const std::vector<double>& costs);
+
+        /// \brief Simulate the job
+        /// \param[in] Maximum number of running units the scheduler waits for before
+        ///            dispatching the next one
+        /// \param[in] Number of cores of the simulated machine
+        /// \return The predicted makespan, utilization and critical path
+        SimulationReport Run(uint32_t max_concurrent_tasks, uint32_t nr_cores) const;
+
+        /// \brief Simulate the job for several "max_concurrent_tasks" values
+        /// \param[in] The values to simulate
+        /// \param[in] Number of cores of the simulated machine
+        /// \return A report per value and the recommended value
+        ConcurrencySweep Sweep(const std::vector<uint32_t>& candidates, uint32_t nr_cores) const;
+};
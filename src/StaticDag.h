@@ -0,0 +1,322 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "mutex.h"
+
+
+/// \brief An edge of a static DAG. Same meaning as JobScheduler::AddTask, i.e., task
+///        "task_id" depends on task "depends_on_task_id".
+struct StaticEdge {
+    uint32_t task_id;
+    uint32_t depends_on_task_id;
+};
+
+
+/// \brief A DAG which shape is known at build time. Tasks are identified by 0 .. N-1.
+///        Indegrees, the topological order (Kahn's algorithm, same BFS order as the
+///        JobScheduler) and the level of every task are computed by the constexpr
+///        constructor. Declaring a cyclic StaticDag as constexpr is a compile error.
+/// \param[in] N number of tasks
+/// \param[in] E number of edges
+template <uint32_t N, std::size_t E>
+class StaticDag {
+    private:
+        std::array<StaticEdge, E> edges_ {};
+
+        // E.g., indegrees_[4] = 2  means that task 4 depends on two other tasks
+        std::array<uint32_t, N> indegrees_ {};
+
+        // the children of task t are children_[child_offsets_[t] .. child_offsets_[t+1])
+        std::array<uint32_t, N + 1> child_offsets_ {};
+        std::array<uint32_t, E> children_ {};
+
+        // tasks in topological order
+        std::array<uint32_t, N> order_ {};
+
+        // E.g., levels_[5] = 2  means that the longest path from a root to task 5 has
+        //  two edges
+        std::array<uint32_t, N> levels_ {};
+        uint32_t nr_levels_ = 0;
+
+        /// \brief Copy edges given as a built-in array
+        /// \param[in] The edges of the DAG
+        /// \return The edges of the DAG
+        static constexpr std::array<StaticEdge, E> ToArray(const StaticEdge (&edges)[E]) {
+            std::array<StaticEdge, E> copy {};
+            for(std::size_t e = 0; e < E; e++) {
+                copy[e] = edges[e];
+            }
+            return copy;
+        }
+
+    public:
+        constexpr StaticDag(const StaticEdge (&edges)[E]) : StaticDag(ToArray(edges)) {}
+
+        constexpr StaticDag(const std::array<StaticEdge, E>& edges) {
+            for(std::size_t e = 0; e < E; e++) {
+                if(edges[e].task_id >= N || edges[e].depends_on_task_id >= N) {
+                    throw std::out_of_range("StaticDag: task id out of range");
+                }
+                edges_[e] = edges[e];
+                indegrees_[edges[e].task_id]++;
+                child_offsets_[edges[e].depends_on_task_id + 1]++;
+            }
+
+            // adjacency list in compressed sparse row format
+            for(uint32_t t = 0; t < N; t++) {
+                child_offsets_[t + 1] += child_offsets_[t];
+            }
+            std::array<uint32_t, N> fill {};
+            for(std::size_t e = 0; e < E; e++) {
+                uint32_t parent = edges[e].depends_on_task_id;
+                children_[child_offsets_[parent] + fill[parent]++] = edges[e].task_id;
+            }
+
+            // Kahn's algorithm, order_ doubles as the queue
+            std::array<uint32_t, N> indegrees = indegrees_;
+            uint32_t tail = 0;
+            for(uint32_t t = 0; t < N; t++) {
+                if(indegrees[t] == 0) {
+                    order_[tail++] = t;
+                }
+            }
+            for(uint32_t head = 0; head < tail; head++) {
+                uint32_t t = order_[head];
+                if(levels_[t] + 1 > nr_levels_) {
+                    nr_levels_ = levels_[t] + 1;
+                }
+                for(uint32_t c = child_offsets_[t]; c < child_offsets_[t + 1]; c++) {
+                    uint32_t child = children_[c];
+                    if(levels_[t] + 1 > levels_[child]) {
+                        levels_[child] = levels_[t] + 1;
+                    }
+                    if(--indegrees[child] == 0) {
+                        order_[tail++] = child;
+                    }
+                }
+            }
+
+            if(tail != N) {
+                throw std::logic_error("StaticDag: the graph has cyclic dependencies");
+            }
+        }
+
+        /// \brief Return the number of tasks
+        /// \return Number of tasks
+        static constexpr uint32_t NrTasks() {
+            return N;
+        }
+
+        /// \brief Return the number of edges
+        /// \return Number of edges
+        static constexpr std::size_t NrEdges() {
+            return E;
+        }
+
+        /// \brief Return an edge, in declaration order
+        /// \param[in] Index of the edge
+        /// \return The edge
+        constexpr StaticEdge Edge(std::size_t e) const {
+            return edges_[e];
+        }
+
+        /// \brief Return the number of tasks a task depends on
+        /// \param[in] A task id
+        /// \return Indegree of the task
+        constexpr uint32_t Indegree(uint32_t task_id) const {
+            return indegrees_[task_id];
+        }
+
+        /// \brief Return the number of tasks depending on a task
+        /// \param[in] A task id
+        /// \return Number of children of the task
+        constexpr uint32_t NrChildren(uint32_t task_id) const {
+            return child_offsets_[task_id + 1] - child_offsets_[task_id];
+        }
+
+        /// \brief Return a child of a task
+        /// \param[in] A task id
+        /// \param[in] Index of the child, 0 .. NrChildren(task_id) - 1
+        /// \return Id of the child
+        constexpr uint32_t Child(uint32_t task_id, uint32_t i) const {
+            return children_[child_offsets_[task_id] + i];
+        }
+
+        /// \brief Return the i-th task in topological order
+        /// \param[in] Position in the topological order
+        /// \return A task id
+        constexpr uint32_t Order(uint32_t i) const {
+            return order_[i];
+        }
+
+        /// \brief Return the level of a task (longest path from a root task)
+        /// \param[in] A task id
+        /// \return Level of the task
+        constexpr uint32_t Level(uint32_t task_id) const {
+            return levels_[task_id];
+        }
+
+        /// \brief Return the number of levels of the DAG
+        /// \return Number of levels
+        constexpr uint32_t NrLevels() const {
+            return nr_levels_;
+        }
+};
+
+
+/// \brief Declare a static DAG. E.g.,
+///            constexpr auto dag = MakeStaticDag<3>({{1, 0}, {2, 1}});
+///        declares the chain 0 -> 1 -> 2.
+/// \param[in] N number of tasks
+/// \param[in] The edges of the DAG
+/// \return The static DAG
+template <uint32_t N, std::size_t E>
+constexpr StaticDag<N, E> MakeStaticDag(const StaticEdge (&edges)[E]) {
+    return StaticDag<N, E>(edges);
+}
+
+
+/// \brief Executor specialized for one static DAG. There is no runtime graph
+///        construction and the graph needs no hash maps: dependency counters and the ready
+///        queue are statically sized arrays. "nr_workers" threads pull ready tasks and
+///        release the children of finished tasks. Same as the JobScheduler, a task
+///        throwing an exception fails and all tasks depending on it are skipped.
+/// \param[in] Dag a static DAG with static storage duration
+template <const auto& Dag>
+class StaticExecutor {
+    private:
+        static constexpr uint32_t N = std::decay_t<decltype(Dag)>::NrTasks();
+
+        // number of parent tasks which are not done yet
+        std::array<uint32_t, N> pending_ GUARDED_BY(mutex_);
+
+        // every task is queued exactly once, so the ready queue never wraps
+        std::array<uint32_t, N> ready_ GUARDED_BY(mutex_);
+        uint32_t ready_head_ GUARDED_BY(mutex_);
+        uint32_t ready_tail_ GUARDED_BY(mutex_);
+        uint32_t nr_done_ GUARDED_BY(mutex_);
+
+        // tasks depending on a failed or skipped task are not executed
+        std::array<bool, N> skipped_ GUARDED_BY(mutex_);
+        std::unordered_map<uint32_t, std::exception_ptr> failed_tasks_ GUARDED_BY(mutex_);
+
+        // notified whenever a task is queued or done
+        std::condition_variable_any ready_cv_;
+        Mutex mutex_;
+
+        /// \brief Execute ready tasks until all tasks are done
+        /// \param[in] The work performed for every task
+        /// \return None
+        template <class F>
+        void Worker(F& work) {
+            while(true) {
+                uint32_t task_id;
+                bool skip;
+                {
+                    MutexLocker lock(&mutex_);
+                    ready_cv_.wait(mutex_, [this]() NO_THREAD_SAFETY_ANALYSIS {
+                        return ready_head_ != ready_tail_ || nr_done_ == N; });
+                    if(ready_head_ == ready_tail_) {
+                        return;
+                    }
+                    task_id = ready_[ready_head_++];
+                    skip = skipped_[task_id];
+                }
+
+                std::exception_ptr failure;
+                if(!skip) {
+                    try {
+                        work(task_id);
+                    } catch(...) {
+                        failure = std::current_exception();
+                    }
+                }
+
+                // the last parent to finish queues the child
+                MutexLocker lock(&mutex_);
+                if(failure) {
+                    failed_tasks_[task_id] = failure;
+                }
+                for(uint32_t i = 0; i < Dag.NrChildren(task_id); i++) {
+                    uint32_t child = Dag.Child(task_id, i);
+                    if(skip || failure) {
+                        skipped_[child] = true;
+                    }
+                    if(--pending_[child] == 0) {
+                        ready_[ready_tail_++] = child;
+                    }
+                }
+                nr_done_++;
+                ready_cv_.notify_all();
+            }
+        }
+
+    public:
+        /// \brief Execute all tasks of the DAG. Returns once all tasks are done.
+        /// \param[in] The work performed for every task, called with the task id. Throwing
+        ///            an exception marks the task as failed.
+        /// \param[in] Number of threads executing tasks (at least one)
+        /// \return True if all tasks finished successfully. False, otherwise
+        template <class F>
+        bool Run(F work, uint32_t nr_workers) {
+            if(nr_workers == 0) {
+                throw std::invalid_argument("StaticExecutor needs at least one worker");
+            }
+            {
+                MutexLocker lock(&mutex_);
+                ready_head_ = 0;
+                ready_tail_ = 0;
+                nr_done_ = 0;
+                failed_tasks_.clear();
+                for(uint32_t t = 0; t < N; t++) {
+                    pending_[t] = Dag.Indegree(t);
+                    skipped_[t] = false;
+                }
+                for(uint32_t i = 0; i < N && Dag.Indegree(Dag.Order(i)) == 0; i++) {
+                    ready_[ready_tail_++] = Dag.Order(i);
+                }
+            }
+
+            std::vector<std::thread> workers;
+            for(uint32_t w = 0; w < nr_workers; w++) {
+                workers.emplace_back([this, &work]() { Worker(work); });
+            }
+            for(auto& w : workers) {
+                w.join();
+            }
+
+            MutexLocker lock(&mutex_);
+            return failed_tasks_.empty();
+        }
+
+        /// \brief Return the tasks which failed during the last Run
+        /// \return key: task id   value: the exception it failed with
+        std::unordered_map<uint32_t, std::exception_ptr> FailedTasks() {
+            MutexLocker lock(&mutex_);
+            return failed_tasks_;
+        }
+
+        /// \brief Return the tasks which were skipped during the last Run, since a task
+        ///        they depend on failed
+        /// \return Ids of the skipped tasks
+        std::set<uint32_t> SkippedTasks() {
+            MutexLocker lock(&mutex_);
+            std::set<uint32_t> skipped_tasks;
+            for(uint32_t t = 0; t < N; t++) {
+                if(skipped_[t]) {
+                    skipped_tasks.insert(t);
+                }
+            }
+            return skipped_tasks;
+        }
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <functional>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "Cancellation.h"
+
+// work of a task of a sub graph, called with the (local) id of the task
+typedef std::function<void(const uint32_t, const CancellationToken&)> sub_graph_work_function_t;
+
+
+/// \brief A DAG spawned by a running task (see JobScheduler::Spawn). Tasks are identified
+///        by local ids, the job scheduler assigns them unique ids when they are spawned.
+class SubGraph {
+    private:
+        // (task_id, depends_on_task_id), same meaning as JobScheduler::AddTask
+        std::vector<std::pair<uint32_t, uint32_t>> edges_;
+        std::set<uint32_t> task_ids_;
+        sub_graph_work_function_t work_;
+
+    public:
+        /// \brief Add a task without dependencies
+        /// \param[in] A (local) id representing a task
+        /// \return None.
+        void AddTask(uint32_t task_id) {
+            task_ids_.insert(task_id);
+        }
+
+        /// \brief Add a task depending on another task of this sub graph
+        /// \param[in] A (local) id representing a task
+        /// \param[in] The (local) id of the task this task depends on
+        /// \return None.
+        void AddTask(uint32_t task_id, uint32_t depends_on_task_id) {
+            edges_.emplace_back(task_id, depends_on_task_id);
+            task_ids_.insert(task_id);
+            task_ids_.insert(depends_on_task_id);
+        }
+
+        /// \brief Set the work performed for every task of this sub graph. The work may
+        ///        spawn further sub graphs.
+        /// \param[in] The work function
+        /// \return None.
+        void SetWork(sub_graph_work_function_t work) {
+            work_ = work;
+        }
+
+        /// \brief Return all dependencies
+        /// \return List of (task_id, depends_on_task_id)
+        const std::vector<std::pair<uint32_t, uint32_t>>& Edges() const {
+            return edges_;
+        }
+
+        /// \brief Return all tasks
+        /// \return Set of (local) task ids
+        const std::set<uint32_t>& TaskIds() const {
+            return task_ids_;
+        }
+
+        /// \brief Return the work performed for every task
+        /// \return The work function
+        const sub_graph_work_function_t& Work() const {
+            return work_;
+        }
+};
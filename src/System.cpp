@@ -1,6 +1,52 @@
 
 #include "System.h"
 
+#include <stdexcept>
+
+thread_local int64_t System::current_task = -1;
+
+
+/// \brief Wait for all executions/tasks to be done before their futures are
+///        destroyed. (tasks still waiting for their parents access task_map)
+System::~System() {
+    // running tasks may still spawn further tasks, wait until no new ones show up
+    size_t nr_waited = 0;
+    while(true) {
+        std::vector<std::future<void>*> futures;
+        mutex.Lock();
+        if(task_map.size() == nr_waited) {
+            mutex.Unlock();
+            break;
+        }
+        for(auto& t: task_map) {
+            futures.emplace_back(&t.second);
+        }
+        mutex.Unlock();
+
+        // do not hold the mutex while waiting, the tasks need it to check their parents
+        for(auto f : futures) {
+            f->wait();
+        }
+        nr_waited = futures.size();
+    }
+}
+
+
+/// \brief Return the task executed by the current thread
+/// \return The id of the task, -1 if the thread does not execute a task
+int64_t System::CurrentTask() {
+    return current_task;
+}
+
+
+/// \brief Set the task executed by the current thread
+/// \param[in] The id of the task, -1 if the thread does not execute a task
+/// \return None
+void System::SetCurrentTask(int64_t id) {
+    current_task = id;
+}
+
+
 /// \brief Track a new execution/task
 /// \param[in] A unique id representing an execution/task
 /// \return None
@@ -8,58 +54,317 @@ void System::AddTask(uint32_t id, std::future<void> f) {
     // std::lock_guard<std::mutex> guard(task_map_mutex);
     mutex.Lock();
     task_map[id] = std::move(f);
+    nr_running++;
     mutex.Unlock();
 }
 
 
-/// \brief Check if a specific execution/task is done
+/// \brief Check if a specific execution/task failed, was skipped or is still
+///        running past its deadline (which is recorded as a failure)
 /// \param[in] A unique id representing an execution/task
-/// \return True if the operation is done. False, otherwise
-bool System::CheckTaskDone(uint32_t task_id) {
-    mutex.Lock();
-    std::chrono::milliseconds span(100);
-    bool ready = (task_map[task_id].wait_for(span) == std::future_status::ready);
-    mutex.Unlock();
-    return ready;
+/// \return True if the task did or will not finish successfully. False, otherwise
+bool System::CheckTaskFailed(uint32_t task_id) {
+    if(failed_tasks.find(task_id) != failed_tasks.end() ||
+       skipped_tasks.find(task_id) != skipped_tasks.end()) {
+        return true;
+    }
+
+    // an overrunning task is treated as failed right away, there is no need to wait
+    //  until it notices its cancellation token
+    auto deadline = deadlines.find(task_id);
+    if(deadline == deadlines.end() || std::chrono::steady_clock::now() < deadline->second) {
+        return false;
+    }
+    if(completed_tasks.find(task_id) == completed_tasks.end()) {
+        failed_tasks[task_id] = std::make_exception_ptr(TaskCancelled("deadline exceeded"));
+        return true;
+    }
+    return false;
+}
+
+
+/// \brief Record a task as failed, since a task it spawned failed or was skipped
+/// \param[in] A unique id representing an execution/task
+/// \return None
+void System::RecordFailedChildren(uint32_t task_id) {
+    // keep the first failure (e.g. of the work of the task itself)
+    if(failed_tasks.find(task_id) == failed_tasks.end()) {
+        failed_tasks[task_id] = std::make_exception_ptr(std::runtime_error("spawned task failed"));
+    }
 }
 
 
 /// \brief Compute the number of actively running executions
 /// \return Number of active executions/tasks
 uint32_t System::NrRunningTasks() {
-    mutex.Lock();
-    uint32_t nr_running = 0;
-    std::chrono::milliseconds span(10);
-    for(const auto& t: task_map) {
-        if(t.second.wait_for(span) == std::future_status::timeout) {
-            nr_running++;
+    MutexLocker lock(&mutex);
+    return nr_running > 0 ? nr_running : 0;
+}
+
+
+/// \brief Compute the number of executions executing their work, i.e., running
+///        and not waiting for the tasks they depend on
+/// \return Number of working executions/tasks
+uint32_t System::NrWorkingTasks() {
+    MutexLocker lock(&mutex);
+    return working_tasks.size();
+}
+
+
+/// \brief Wait until at most "max_running" executions are active
+/// \param[in] Maximum number of active executions/tasks
+/// \param[in] Maximum time to wait
+/// \return True if at most "max_running" executions are active. False, otherwise
+bool System::WaitForRunningTasks(uint32_t max_running, std::chrono::milliseconds timeout) {
+    MutexLocker lock(&mutex);
+    return state_changed.wait_for(mutex, timeout, [this, max_running]() NO_THREAD_SAFETY_ANALYSIS {
+        return nr_running <= static_cast<int64_t>(max_running); });
+}
+
+
+/// \brief Check if an execution/task is tracked, i.e., it has been started via
+///        AddTask
+/// \param[in] A unique id representing an execution/task
+/// \return True if the task is tracked. False, otherwise
+bool System::IsDispatched(uint32_t id) {
+    MutexLocker lock(&mutex);
+    return task_map.find(id) != task_map.end();
+}
+
+
+/// \brief Register a function called (without holding any lock) whenever a task
+///        completes. Has to be called before any task is started.
+/// \param[in] The function, called with the id of the completed task
+/// \return None
+void System::OnTaskComplete(std::function<void(uint32_t)> hook) {
+    completion_hook = hook;
+}
+
+
+/// \brief Register a function called (without holding any lock) whenever the work
+///        of a task returns, i.e., it frees its slot. Has to be called before any
+///        task is started.
+/// \param[in] The function, called with the id of the task
+/// \return None
+void System::OnTaskFinish(std::function<void(uint32_t)> hook) {
+    finish_hook = hook;
+}
+
+
+/// \brief Record that a task is done (successfully, failed or skipped). Failures
+///        have to be recorded (FailTask, SkipTask) before. Completes the task
+///        which spawned it as well, if this was its last pending spawned task.
+/// \param[in] A unique id representing an execution/task
+/// \return True if the task was not completed before. False, otherwise
+bool System::CompleteTask(uint32_t id) {
+    std::vector<uint32_t> completed;
+    {
+        MutexLocker lock(&mutex);
+        if(!completed_tasks.insert(id).second) {
+            return false;
+        }
+        completed.emplace_back(id);
+
+        // walk up the spawning tasks, as long as their last pending spawned task completed
+        uint32_t child = id;
+        auto parent = spawned_by.find(child);
+        while(parent != spawned_by.end()) {
+            uint32_t parent_id = parent->second;
+            if(failed_tasks.find(child) != failed_tasks.end() ||
+               skipped_tasks.find(child) != skipped_tasks.end()) {
+                failed_children.insert(parent_id);
+            }
+            if(--pending_children[parent_id] > 0 || awaiting_children.erase(parent_id) == 0) {
+                break;
+            }
+
+            if(failed_children.find(parent_id) != failed_children.end()) {
+                RecordFailedChildren(parent_id);
+            }
+            completed_tasks.insert(parent_id);
+            completed.emplace_back(parent_id);
+            child = parent_id;
+            parent = spawned_by.find(child);
         }
     }
-    mutex.Unlock();
-    return nr_running;
+    state_changed.notify_all();
+
+    if(completion_hook) {
+        for(const auto& c : completed) {
+            completion_hook(c);
+        }
+    }
+    return true;
+}
+
+
+/// \brief Record that the work of a task started via AddTask returned. The task
+///        is completed, unless tasks it spawned are still pending. Then, it
+///        completes together with the last of them.
+/// \param[in] A unique id representing an execution/task
+/// \return None
+void System::FinishTask(uint32_t id) {
+    bool await_children = false;
+    {
+        MutexLocker lock(&mutex);
+        nr_running--;
+        working_tasks.erase(id);
+        // the deadline only limits the work, not the spawned tasks
+        deadlines.erase(id);
+
+        auto pending = pending_children.find(id);
+        if(pending != pending_children.end() && pending->second > 0) {
+            awaiting_children.insert(id);
+            await_children = true;
+        } else if(failed_children.find(id) != failed_children.end()) {
+            // all spawned tasks completed before the work returned
+            RecordFailedChildren(id);
+        }
+    }
+
+    if(await_children) {
+        state_changed.notify_all();
+    } else {
+        CompleteTask(id);
+    }
+
+    if(finish_hook) {
+        finish_hook(id);
+    }
+}
+
+
+/// \brief Record that a running task spawned further tasks. It is not completed
+///        before all of them are completed, and fails if one of them fails.
+/// \param[in] The id of the spawning task
+/// \param[in] The ids of the spawned tasks
+/// \return None
+void System::AddChildren(uint32_t id, const std::vector<uint32_t>& children) {
+    MutexLocker lock(&mutex);
+    pending_children[id] += children.size();
+    for(const auto& child : children) {
+        spawned_by[child] = id;
+    }
+}
+
+
+/// \brief Record that a task started to execute (part of) its work, it counts as
+///        working until FinishTask. Replaces the deadline recorded before.
+/// \param[in] A unique id representing an execution/task
+/// \param[in] The deadline of the task. (deadline_t::max() if there is none)
+/// \return None
+void System::StartTask(uint32_t id, deadline_t deadline) {
+    MutexLocker lock(&mutex);
+    working_tasks.insert(id);
+    if(deadline == deadline_t::max()) {
+        deadlines.erase(id);
+    } else {
+        deadlines[id] = deadline;
+    }
+}
+
+
+/// \brief Record that a task failed
+/// \param[in] A unique id representing an execution/task
+/// \param[in] The exception the task failed with
+/// \return None
+void System::FailTask(uint32_t id, std::exception_ptr e) {
+    {
+        MutexLocker lock(&mutex);
+        // keep the first failure (e.g. "deadline exceeded" recorded by a waiting task)
+        if(failed_tasks.find(id) == failed_tasks.end()) {
+            failed_tasks[id] = e;
+        }
+    }
+    state_changed.notify_all();
+}
+
+
+/// \brief Record that a task is not executed (since a task it depends on failed)
+/// \param[in] A unique id representing an execution/task
+/// \return True if the task was not skipped before. False, otherwise
+bool System::SkipTask(uint32_t id) {
+    bool skipped;
+    {
+        MutexLocker lock(&mutex);
+        skipped = skipped_tasks.insert(id).second;
+    }
+    state_changed.notify_all();
+    return skipped;
+}
+
+
+/// \brief Check if a task is skipped
+/// \param[in] A unique id representing an execution/task
+/// \return True if the task is skipped. False, otherwise
+bool System::IsSkipped(uint32_t id) {
+    MutexLocker lock(&mutex);
+    return skipped_tasks.find(id) != skipped_tasks.end();
+}
+
+
+/// \brief Check if a task failed
+/// \param[in] A unique id representing an execution/task
+/// \return True if the task failed. False, otherwise
+bool System::IsFailed(uint32_t id) {
+    MutexLocker lock(&mutex);
+    return failed_tasks.find(id) != failed_tasks.end();
+}
+
+
+/// \brief Return all failed tasks
+/// \return key: task id   value: the exception the task failed with
+std::unordered_map<uint32_t, std::exception_ptr> System::FailedTasks() {
+    MutexLocker lock(&mutex);
+    return failed_tasks;
+}
+
+
+/// \brief Return all skipped tasks
+/// \return Ids of the skipped tasks
+std::set<uint32_t> System::SkippedTasks() {
+    MutexLocker lock(&mutex);
+    return skipped_tasks;
 }
 
 
 /// \brief The executing instance of this function will stall until all tasks
 ///        provided to this function are done.
 /// \param[in] A list of unique ids representing tasks which are to be waited for
-/// \return None
-void System::WaitForTasks(const std::vector<uint32_t>& task_ids) {
-    std::set<uint32_t> finished_tasks;
+/// \param[in] Stop waiting once this token is cancelled
+/// \return True if all tasks finished successfully. False as soon as one of them
+///         failed or was skipped, or the token was cancelled
+bool System::WaitForTasks(const std::vector<uint32_t>& task_ids,
+                          const CancellationToken& token) {
+    // wake up regularly to notice cancellation and deadlines, which are not signalled
+    const std::chrono::milliseconds slice(5);
+    MutexLocker lock(&mutex);
 
-    while(finished_tasks.size() != task_ids.size()) {
+    while(true) {
+        bool all_done = true;
         for(const auto& task_id : task_ids) {
-            if(finished_tasks.find(task_id) == finished_tasks.end() && CheckTaskDone(task_id)) {
-                finished_tasks.insert(task_id);
+            // a task records its failure before it is completed
+            if(CheckTaskFailed(task_id)) {
+                return false;
             }
+            if(completed_tasks.find(task_id) == completed_tasks.end()) {
+                all_done = false;
+            }
+        }
+        if(all_done) {
+            return true;
         }
-                
+        if(token.IsCancelled()) {
+            return false;
+        }
+
         #ifdef __DEBUG__
-            for(const auto& task : task_map) {
-                bool completed = (task.second.wait_for(span) == std::future_status::ready);
-                std::cout << "task id: " << task.first << " -> completed [yes/no]: " << completed << std::endl;
+            for(const auto& task_id : task_ids) {
+                bool completed = (completed_tasks.find(task_id) != completed_tasks.end());
+                std::cout << "task id: " << task_id << " -> completed [yes/no]: " << completed << std::endl;
             }
-            std::this_thread::sleep_for(std::chrono::seconds(1));
         #endif
+
+        state_changed.wait_for(mutex, slice);
     }
 }
@@ -6,10 +6,14 @@
 #include <string>
 #include <iostream>
 #include <set>
+#include <unordered_set>
 #include <future>         // std::async, std::future
+#include <functional>
+#include <condition_variable>
 #include <vector>
 
 #include "mutex.h"
+#include "Cancellation.h"
 
 /// \brief A very simplified view of a compute a system.
 ///        This system keeps track of running executions and their state (active or done)
@@ -17,14 +21,81 @@ class System {
     private:
         // key: task-id   value: the future (result0 of the asynchronous task
         std::unordered_map<uint32_t, std::future<void>> task_map GUARDED_BY(mutex);
+
+        // key: task-id   value: the exception a task failed with (TaskCancelled if it
+        //  was cancelled or ran past its deadline)
+        std::unordered_map<uint32_t, std::exception_ptr> failed_tasks GUARDED_BY(mutex);
+
+        // tasks which are not executed since a task they depend on failed
+        std::set<uint32_t> skipped_tasks GUARDED_BY(mutex);
+
+        // key: task-id   value: the deadline of a started task
+        std::unordered_map<uint32_t, deadline_t> deadlines GUARDED_BY(mutex);
+
+        // tasks which are done (successfully, failed or skipped)
+        std::unordered_set<uint32_t> completed_tasks GUARDED_BY(mutex);
+
+        // number of tracked executions/tasks whose work is not finished yet. (signed: a
+        //  task may finish before its future is tracked)
+        int64_t nr_running GUARDED_BY(mutex);
+
+        // tasks executing their work, i.e., started and no longer waiting for their parents
+        std::unordered_set<uint32_t> working_tasks GUARDED_BY(mutex);
+
+        // key: task-id   value: number of tasks spawned by the task, which are not
+        //  completed yet
+        std::unordered_map<uint32_t, uint32_t> pending_children GUARDED_BY(mutex);
+
+        // key: spawned task-id   value: the task which spawned it
+        std::unordered_map<uint32_t, uint32_t> spawned_by GUARDED_BY(mutex);
+
+        // tasks whose work is finished, but which wait for the tasks they spawned
+        std::unordered_set<uint32_t> awaiting_children GUARDED_BY(mutex);
+
+        // tasks which spawned a task that failed or was skipped
+        std::unordered_set<uint32_t> failed_children GUARDED_BY(mutex);
+
+        // the task executed by the current thread, -1 if none
+        static thread_local int64_t current_task;
+
+        // notified whenever a task completes, fails or is skipped
+        std::condition_variable_any state_changed;
+
+        // called whenever a task completes
+        std::function<void(uint32_t)> completion_hook;
+
+        // called whenever the work of a task returns
+        std::function<void(uint32_t)> finish_hook;
         Mutex mutex;
         
-        /// \brief Check if a specific execution/task is done
+        /// \brief Check if a specific execution/task failed, was skipped or is still
+        ///        running past its deadline (which is recorded as a failure)
         /// \param[in] A unique id representing an execution/task
-        /// \return True if the operation is done. False, otherwise
-        bool CheckTaskDone(uint32_t task_id);
+        /// \return True if the task did or will not finish successfully. False, otherwise
+        bool CheckTaskFailed(uint32_t task_id) REQUIRES(mutex);
+
+        /// \brief Record a task as failed, since a task it spawned failed or was skipped
+        /// \param[in] A unique id representing an execution/task
+        /// \return None
+        void RecordFailedChildren(uint32_t task_id) REQUIRES(mutex);
 
     public:	
+        System() : nr_running(0) {}
+
+
+        /// \brief Wait for all executions/tasks to be done before their futures are
+        ///        destroyed. (tasks still waiting for their parents access task_map)
+        ~System();
+
+        /// \brief Return the task executed by the current thread
+        /// \return The id of the task, -1 if the thread does not execute a task
+        static int64_t CurrentTask();
+
+        /// \brief Set the task executed by the current thread
+        /// \param[in] The id of the task, -1 if the thread does not execute a task
+        /// \return None
+        static void SetCurrentTask(int64_t id);
+
         /// \brief Track a new execution/task
         /// \param[in] A unique id representing an execution/task
         /// \return None
@@ -34,9 +105,99 @@ class System {
         /// \return Number of active executions/tasks
         uint32_t NrRunningTasks();
 
+        /// \brief Compute the number of executions executing their work, i.e., running
+        ///        and not waiting for the tasks they depend on
+        /// \return Number of working executions/tasks
+        uint32_t NrWorkingTasks();
+
+        /// \brief Wait until at most "max_running" executions are active
+        /// \param[in] Maximum number of active executions/tasks
+        /// \param[in] Maximum time to wait
+        /// \return True if at most "max_running" executions are active. False, otherwise
+        bool WaitForRunningTasks(uint32_t max_running, std::chrono::milliseconds timeout);
+
+        /// \brief Check if an execution/task is tracked, i.e., it has been started via
+        ///        AddTask
+        /// \param[in] A unique id representing an execution/task
+        /// \return True if the task is tracked. False, otherwise
+        bool IsDispatched(uint32_t id);
+
+        /// \brief Register a function called (without holding any lock) whenever a task
+        ///        completes. Has to be called before any task is started.
+        /// \param[in] The function, called with the id of the completed task
+        /// \return None
+        void OnTaskComplete(std::function<void(uint32_t)> hook);
+
+        /// \brief Register a function called (without holding any lock) whenever the work
+        ///        of a task returns, i.e., it frees its slot. Has to be called before any
+        ///        task is started.
+        /// \param[in] The function, called with the id of the task
+        /// \return None
+        void OnTaskFinish(std::function<void(uint32_t)> hook);
+
+        /// \brief Record that a task is done (successfully, failed or skipped). Failures
+        ///        have to be recorded (FailTask, SkipTask) before. Completes the task
+        ///        which spawned it as well, if this was its last pending spawned task.
+        /// \param[in] A unique id representing an execution/task
+        /// \return True if the task was not completed before. False, otherwise
+        bool CompleteTask(uint32_t id);
+
+        /// \brief Record that the work of a task started via AddTask returned. The task
+        ///        is completed, unless tasks it spawned are still pending. Then, it
+        ///        completes together with the last of them.
+        /// \param[in] A unique id representing an execution/task
+        /// \return None
+        void FinishTask(uint32_t id);
+
+        /// \brief Record that a running task spawned further tasks. It is not completed
+        ///        before all of them are completed, and fails if one of them fails.
+        /// \param[in] The id of the spawning task
+        /// \param[in] The ids of the spawned tasks
+        /// \return None
+        void AddChildren(uint32_t id, const std::vector<uint32_t>& children);
+
+        /// \brief Record that a task started to execute (part of) its work, it counts as
+        ///        working until FinishTask. Replaces the deadline recorded before.
+        /// \param[in] A unique id representing an execution/task
+        /// \param[in] The deadline of the task. (deadline_t::max() if there is none)
+        /// \return None
+        void StartTask(uint32_t id, deadline_t deadline);
+
+        /// \brief Record that a task failed
+        /// \param[in] A unique id representing an execution/task
+        /// \param[in] The exception the task failed with
+        /// \return None
+        void FailTask(uint32_t id, std::exception_ptr e);
+
+        /// \brief Record that a task is not executed (since a task it depends on failed)
+        /// \param[in] A unique id representing an execution/task
+        /// \return True if the task was not skipped before. False, otherwise
+        bool SkipTask(uint32_t id);
+
+        /// \brief Check if a task is skipped
+        /// \param[in] A unique id representing an execution/task
+        /// \return True if the task is skipped. False, otherwise
+        bool IsSkipped(uint32_t id);
+
+        /// \brief Check if a task failed
+        /// \param[in] A unique id representing an execution/task
+        /// \return True if the task failed. False, otherwise
+        bool IsFailed(uint32_t id);
+
+        /// \brief Return all failed tasks
+        /// \return key: task id   value: the exception the task failed with
+        std::unordered_map<uint32_t, std::exception_ptr> FailedTasks();
+
+        /// \brief Return all skipped tasks
+        /// \return Ids of the skipped tasks
+        std::set<uint32_t> SkippedTasks();
+
         /// \brief The executing instance of this function will stall until all tasks
         ///        provided to this function are done.
         /// \param[in] A list of unique ids representing tasks which are to be waited for
-        /// \return None
-        void WaitForTasks(const std::vector<uint32_t>& task_ids);
+        /// \param[in] Stop waiting once this token is cancelled
+        /// \return True if all tasks finished successfully. False as soon as one of them
+        ///         failed or was skipped, or the token was cancelled
+        bool WaitForTasks(const std::vector<uint32_t>& task_ids,
+                          const CancellationToken& token);
 };
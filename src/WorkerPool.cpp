@@ -0,0 +1,350 @@
+
+#include "WorkerPool.h"
+#include "Cancellation.h"
+
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <signal.h>
+#include <stdexcept>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+/// \brief Back off while waiting for messages: spin briefly, then sleep
+/// \param[in,out] Number of consecutive unsuccessful polls
+/// \return None
+static void Backoff(uint32_t& idle_polls) {
+    if(++idle_polls < 100) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+
+// the channel of this worker process, nullptr in the coordinator
+static WorkerChannel* worker_channel = nullptr;
+
+
+WorkerPool::WorkerPool(uint32_t nr_workers) :
+    nr_workers_(nr_workers),
+    channels_(nullptr),
+    pids_(nr_workers, -1),
+    in_flight_(nr_workers, -1) {}
+
+
+/// \brief Shut down all workers and release the shared memory
+WorkerPool::~WorkerPool() {
+    Shutdown();
+    if(channels_ != nullptr) {
+        munmap(channels_, sizeof(WorkerChannel) * nr_workers_);
+    }
+}
+
+
+/// \brief Called by the work of a worker process whenever the dispatched unit
+///        starts one of its tasks, so a failure is reported for that task and
+///        the coordinator enforces its deadline
+/// \param[in] Position of the task within the unit
+/// \param[in] Deadline of the task
+/// \return None
+void WorkerPool::StartTask(uint32_t position, deadline_t deadline) {
+    if(worker_channel != nullptr) {
+        worker_channel->deadline.store(deadline.time_since_epoch().count(),
+                                       std::memory_order_release);
+        worker_channel->task_position.store(position, std::memory_order_release);
+    }
+}
+
+
+/// \brief Create a flag in memory shared with the workers forked afterwards,
+///        e.g. the cancel flag of a job
+/// \param[in] Initial value
+/// \return The flag, nullptr if the memory cannot be mapped
+std::shared_ptr<std::atomic<bool>> WorkerPool::SharedFlag(bool value) {
+    static_assert(std::atomic<bool>::is_always_lock_free,
+                  "shared flags require lock-free atomics");
+    void* memory = mmap(nullptr, sizeof(std::atomic<bool>),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        return nullptr;
+    }
+    return std::shared_ptr<std::atomic<bool>>(
+        new (memory) std::atomic<bool>(value),
+        [](std::atomic<bool>* flag) { munmap(flag, sizeof(std::atomic<bool>)); });
+}
+
+
+/// \brief Main loop of a worker process
+/// \param[in] The channel of this worker
+/// \param[in] The work executed for every dispatched unit
+/// \return None (never returns, exits the process)
+void WorkerPool::WorkerLoop(WorkerChannel& channel,
+                            const std::function<void(uint32_t)>& work) {
+    uint32_t idle_polls = 0;
+    TaskMessage msg;
+    worker_channel = &channel;
+
+    while(true) {
+        if(!channel.to_worker.TryPop(msg)) {
+            Backoff(idle_polls);
+            continue;
+        }
+        idle_polls = 0;
+        if(msg.status == TaskMessage::kShutdown) {
+            break;
+        }
+
+        TaskMessage completion;
+        std::memset(&completion, 0, sizeof(completion));
+        completion.unit_id = msg.unit_id;
+        completion.pid = getpid();
+        completion.status = TaskMessage::kDone;
+        channel.task_position.store(0, std::memory_order_release);
+        try {
+            work(msg.unit_id);
+        } catch(const TaskCancelled& e) {
+            completion.status = TaskMessage::kCancelled;
+            std::strncpy(completion.error, e.what(), sizeof(completion.error) - 1);
+        } catch(const std::exception& e) {
+            completion.status = TaskMessage::kFailed;
+            std::strncpy(completion.error, e.what(), sizeof(completion.error) - 1);
+        } catch(...) {
+            completion.status = TaskMessage::kFailed;
+            std::strncpy(completion.error, "unknown exception", sizeof(completion.error) - 1);
+        }
+
+        completion.task_position = channel.task_position.load(std::memory_order_acquire);
+
+        // one unit at a time per worker, the ring cannot be full
+        while(!channel.to_coordinator.TryPush(completion)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // skip atexit handlers and destructors of the state inherited from the coordinator
+    _exit(0);
+}
+
+
+/// \brief Fork the worker processes. Has to be called while no other threads are
+///        running, since only the calling thread survives a fork.
+/// \param[in] The work executed by a worker for every dispatched unit. It is
+///            inherited by the forked processes, side effects stay in the worker.
+/// \return True if all workers were started. False, otherwise
+bool WorkerPool::Start(std::function<void(uint32_t)> work) {
+    work_ = work;
+    void* memory = mmap(nullptr, sizeof(WorkerChannel) * nr_workers_,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        std::cerr << "Cannot map shared memory for " << nr_workers_ << " workers" << std::endl;
+        return false;
+    }
+    channels_ = static_cast<WorkerChannel*>(memory);
+
+    for(uint32_t w = 0; w < nr_workers_; w++) {
+        new (&channels_[w]) WorkerChannel;
+        if(!StartWorker(w)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/// \brief Fork a worker process on its (reset) channel
+/// \param[in] Index of the worker
+/// \return True if the worker was started. False, otherwise
+bool WorkerPool::StartWorker(uint32_t worker) {
+    WorkerChannel& channel = channels_[worker];
+    channel.to_worker.Init();
+    channel.to_coordinator.Init();
+    channel.task_position.store(0);
+    channel.deadline.store(deadline_t::max().time_since_epoch().count());
+
+    // flush buffered output, otherwise it is written by the worker as well
+    std::cout.flush();
+    std::cerr.flush();
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        std::cerr << "Cannot fork worker #" << worker << std::endl;
+        return false;
+    }
+    if(pid == 0) {
+        WorkerLoop(channel, work_);
+    }
+    pids_[worker] = pid;
+    return true;
+}
+
+
+/// \brief Find a worker which is alive and not executing a unit
+/// \return Index of the worker, -1 if there is none
+int32_t WorkerPool::IdleWorker() {
+    for(uint32_t w = 0; w < nr_workers_; w++) {
+        if(pids_[w] > 0 && in_flight_[w] < 0) {
+            return w;
+        }
+    }
+    return -1;
+}
+
+
+/// \brief Return the number of workers which are still alive
+/// \return Number of alive workers
+uint32_t WorkerPool::NrAliveWorkers() {
+    uint32_t nr_alive = 0;
+    for(const auto pid : pids_) {
+        if(pid > 0) {
+            nr_alive++;
+        }
+    }
+    return nr_alive;
+}
+
+
+/// \brief Send an execution unit to an idle worker
+/// \param[in] Index of the worker
+/// \param[in] The id of the execution unit
+/// \return True if the unit was sent. False, otherwise
+bool WorkerPool::Dispatch(uint32_t worker, uint32_t unit_id, deadline_t deadline) {
+    TaskMessage msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.unit_id = unit_id;
+    msg.status = TaskMessage::kDispatch;
+
+    // the worker is idle, it does not write the deadline before receiving the unit
+    channels_[worker].deadline.store(deadline.time_since_epoch().count(),
+                                     std::memory_order_release);
+    if(pids_[worker] <= 0 || !channels_[worker].to_worker.TryPush(msg)) {
+        return false;
+    }
+    in_flight_[worker] = unit_id;
+    return true;
+}
+
+
+/// \brief Receive the next completion of any worker
+/// \param[out] The completion
+/// \return True if a completion was received. False, otherwise
+bool WorkerPool::PollCompletion(TaskMessage& msg) {
+    for(uint32_t w = 0; w < nr_workers_; w++) {
+        if(in_flight_[w] >= 0 && channels_[w].to_coordinator.TryPop(msg)) {
+            in_flight_[w] = -1;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/// \brief Wait for the next completion of any worker
+/// \param[out] The completion
+/// \param[in] Maximum time to wait
+/// \return True if a completion was received. False, otherwise
+bool WorkerPool::WaitForCompletion(TaskMessage& msg, std::chrono::microseconds timeout) {
+    auto end = std::chrono::steady_clock::now() + timeout;
+    uint32_t idle_polls = 0;
+
+    while(!PollCompletion(msg)) {
+        if(std::chrono::steady_clock::now() >= end) {
+            return false;
+        }
+        Backoff(idle_polls);
+    }
+    return true;
+}
+
+
+/// \brief Detect workers which exited unexpectedly (e.g. crashed)
+/// \return Failures of the execution units which were running on these workers
+std::vector<TaskMessage> WorkerPool::ReapDeadWorkers() {
+    std::vector<TaskMessage> lost_units;
+    for(uint32_t w = 0; w < nr_workers_; w++) {
+        int status;
+        if(pids_[w] <= 0 || waitpid(pids_[w], &status, WNOHANG) != pids_[w]) {
+            continue;
+        }
+
+        // a completion sent right before the worker died is still received by
+        //  PollCompletion
+        pid_t pid = pids_[w];
+        pids_[w] = -1;
+        if(in_flight_[w] >= 0 && channels_[w].to_coordinator.Empty()) {
+            TaskMessage lost;
+            std::memset(&lost, 0, sizeof(lost));
+            lost.unit_id = in_flight_[w];
+            lost.status = TaskMessage::kFailed;
+            lost.pid = pid;
+            lost.task_position = channels_[w].task_position.load(std::memory_order_acquire);
+            std::strncpy(lost.error, "worker process died", sizeof(lost.error) - 1);
+            lost_units.emplace_back(lost);
+            in_flight_[w] = -1;
+        }
+    }
+    return lost_units;
+}
+
+
+/// \brief Kill workers whose task ran past its deadline (plus a grace period to
+///        stop cooperatively) and start new workers in their place
+/// \param[in] Grace period
+/// \return Cancellations of the execution units which were running on these workers
+std::vector<TaskMessage> WorkerPool::KillOverdueWorkers(std::chrono::milliseconds grace) {
+    std::vector<TaskMessage> cancelled_units;
+    deadline_t now = std::chrono::steady_clock::now();
+    for(uint32_t w = 0; w < nr_workers_; w++) {
+        if(pids_[w] <= 0 || in_flight_[w] < 0) {
+            continue;
+        }
+        deadline_t deadline(deadline_t::duration(
+            channels_[w].deadline.load(std::memory_order_acquire)));
+        // a completion already sent is received by PollCompletion
+        if(deadline == deadline_t::max() || now < deadline + grace ||
+           !channels_[w].to_coordinator.Empty()) {
+            continue;
+        }
+
+        kill(pids_[w], SIGKILL);
+        waitpid(pids_[w], nullptr, 0);
+
+        TaskMessage cancelled;
+        std::memset(&cancelled, 0, sizeof(cancelled));
+        cancelled.unit_id = in_flight_[w];
+        cancelled.status = TaskMessage::kCancelled;
+        cancelled.pid = pids_[w];
+        cancelled.task_position = channels_[w].task_position.load(std::memory_order_acquire);
+        std::strncpy(cancelled.error, "task killed past its deadline",
+                     sizeof(cancelled.error) - 1);
+        cancelled_units.emplace_back(cancelled);
+
+        pids_[w] = -1;
+        in_flight_[w] = -1;
+        StartWorker(w);
+    }
+    return cancelled_units;
+}
+
+
+/// \brief Ask all workers to exit and wait for them
+/// \return None
+void WorkerPool::Shutdown() {
+    TaskMessage msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.status = TaskMessage::kShutdown;
+
+    for(uint32_t w = 0; w < nr_workers_; w++) {
+        if(pids_[w] <= 0) {
+            continue;
+        }
+        while(!channels_[w].to_worker.TryPush(msg)) {
+            std::this_thread::yield();
+        }
+        waitpid(pids_[w], nullptr, 0);
+        pids_[w] = -1;
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+
+#include "Cancellation.h"
+#include "SharedMemoryRing.h"
+
+/// \brief Message exchanged between the coordinator and a worker process
+struct TaskMessage {
+    enum Status : int32_t {
+        kDispatch = 0,   // coordinator -> worker: execute "unit_id"
+        kShutdown = 1,   // coordinator -> worker: exit
+        kDone = 2,       // worker -> coordinator: "unit_id" finished successfully
+        kFailed = 3,     // worker -> coordinator: "unit_id" threw an exception
+        kCancelled = 4   // worker -> coordinator: "unit_id" was cancelled / past deadline
+    };
+
+    uint32_t unit_id;
+    Status status;
+    int32_t pid;         // the worker process which executed the unit
+    uint32_t task_position; // position of the last task the unit started (see WorkerPool::StartTask)
+    char error[128];     // what() of the exception a failed unit threw
+};
+
+
+/// \brief A pair of rings connecting the coordinator with one worker process
+struct WorkerChannel {
+    SpscRing<TaskMessage, 64> to_worker;
+    SpscRing<TaskMessage, 64> to_coordinator;
+    std::atomic<uint32_t> task_position; // written by the worker, read if it dies
+    std::atomic<int64_t> deadline;       // of the running task, in steady clock ticks
+};
+
+
+/// \brief A local pool of worker processes. The coordinator dispatches ids of execution
+///        units to the workers through lock-free shared memory rings and receives their
+///        completions the same way. Each worker executes one unit at a time.
+///        The transport is limited to one host. The coordinator (see
+///        JobScheduler::ProcessTasksInWorkers) relies on Start, IdleWorker,
+///        NrAliveWorkers, Dispatch, WaitForCompletion, ReapDeadWorkers,
+///        KillOverdueWorkers and Shutdown, the work inside the workers on StartTask,
+///        and the job on a cancel flag created by SharedFlag. Another transport (e.g.
+///        across hosts) has to provide the same.
+class WorkerPool {
+    private:
+        uint32_t nr_workers_;
+        WorkerChannel* channels_;          // shared memory, one channel per worker
+        std::vector<pid_t> pids_;          // -1 once a worker exited
+        std::vector<int64_t> in_flight_;   // unit executed by a worker, -1 if idle
+        std::function<void(uint32_t)> work_;
+
+        /// \brief Fork a worker process on its (reset) channel
+        /// \param[in] Index of the worker
+        /// \return True if the worker was started. False, otherwise
+        bool StartWorker(uint32_t worker);
+
+        /// \brief Main loop of a worker process
+        /// \param[in] The channel of this worker
+        /// \param[in] The work executed for every dispatched unit
+        /// \return None (never returns, exits the process)
+        static void WorkerLoop(WorkerChannel& channel,
+                               const std::function<void(uint32_t)>& work);
+
+    public:
+        WorkerPool(uint32_t nr_workers);
+
+        /// \brief Called by the work of a worker process whenever the dispatched unit
+        ///        starts one of its tasks, so a failure is reported for that task and
+        ///        the coordinator enforces its deadline
+        /// \param[in] Position of the task within the unit
+        /// \param[in] Deadline of the task
+        /// \return None
+        static void StartTask(uint32_t position, deadline_t deadline);
+
+        /// \brief Create a flag in memory shared with the workers forked afterwards,
+        ///        e.g. the cancel flag of a job
+        /// \param[in] Initial value
+        /// \return The flag, nullptr if the memory cannot be mapped
+        static std::shared_ptr<std::atomic<bool>> SharedFlag(bool value);
+
+        /// \brief Shut down all workers and release the shared memory
+        ~WorkerPool();
+
+        /// \brief Fork the worker processes. Has to be called while no other threads are
+        ///        running, since only the calling thread survives a fork.
+        /// \param[in] The work executed by a worker for every dispatched unit. It is
+        ///            inherited by the forked processes, side effects stay in the worker.
+        /// \return True if all workers were started. False, otherwise
+        bool Start(std::function<void(uint32_t)> work);
+
+        /// \brief Find a worker which is alive and not executing a unit
+        /// \return Index of the worker, -1 if there is none
+        int32_t IdleWorker();
+
+        /// \brief Return the number of workers which are still alive
+        /// \return Number of alive workers
+        uint32_t NrAliveWorkers();
+
+        /// \brief Send an execution unit to an idle worker
+        /// \param[in] Index of the worker
+        /// \param[in] The id of the execution unit
+        /// \param[in] Deadline of the unit, until its worker reports a task deadline
+        /// \return True if the unit was sent. False, otherwise
+        bool Dispatch(uint32_t worker, uint32_t unit_id, deadline_t deadline);
+
+        /// \brief Receive the next completion of any worker
+        /// \param[out] The completion
+        /// \return True if a completion was received. False, otherwise
+        bool PollCompletion(TaskMessage& msg);
+
+        /// \brief Wait for the next completion of any worker
+        /// \param[out] The completion
+        /// \param[in] Maximum time to wait
+        /// \return True if a completion was received. False, otherwise
+        bool WaitForCompletion(TaskMessage& msg, std::chrono::microseconds timeout);
+
+        /// \brief Detect workers which exited unexpectedly (e.g. crashed)
+        /// \return Failures of the execution units which were running on these workers
+        std::vector<TaskMessage> ReapDeadWorkers();
+
+        /// \brief Kill workers whose task ran past its deadline (plus a grace period to
+        ///        stop cooperatively) and start new workers in their place
+        /// \param[in] Grace period
+        /// \return Cancellations of the execution units which were running on these workers
+        std::vector<TaskMessage> KillOverdueWorkers(std::chrono::milliseconds grace);
+
+        /// \brief Ask all workers to exit and wait for them
+        /// \return None
+        void Shutdown();
+};
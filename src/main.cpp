@@ -30,7 +30,7 @@ int main() {
 	bool success = job_ptr->ProcessTasks();
 	std::cout << "Success = " << success << std::endl;
 
-	std::this_thread::sleep_for(std::chrono::seconds(20));
+	job_ptr->Handle().Wait();
 
 	global_state_ptr->Print();
 	
@@ -105,6 +105,10 @@ public:
 
   // For negative capabilities.
   const Mutex& operator!() const { return *this; }
+
+  // BasicLockable interface, e.g. to wait on a std::condition_variable_any.
+  void lock() ACQUIRE() { Lock(); }
+  void unlock() RELEASE() { Unlock(); }
 };
 
 inline void Mutex::Lock(){
@@ -1,6 +1,9 @@
 
 #include "gtest/gtest.h"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "./../src/JobScheduler.h"
 
 class TestJobSchedulerFixture : public ::testing::Test {
@@ -41,8 +44,8 @@ TEST_F(TestJobSchedulerFixture, TestA) {
     // Note, this does not mean all the tasks have been finished
     EXPECT_TRUE(success);
 	
-    // sleeping long enough to ensure all tasks have executed
-    std::this_thread::sleep_for(std::chrono::seconds(30));
+    // wait until all tasks have executed
+    job_ptr->Handle().Wait();
     std::string state = global_state_ptr->GetState();
     
     EXPECT_EQ(state, "0132546");
@@ -79,8 +82,8 @@ TEST_F(TestJobSchedulerFixture, TestB) {
     // Note, this does not mean all the tasks have been finished
     EXPECT_TRUE(success);
 	
-    // sleeping long enough to ensure all tasks have executed
-    std::this_thread::sleep_for(std::chrono::seconds(30));
+    // wait until all tasks have executed
+    job_ptr->Handle().Wait();
     std::string state = global_state_ptr->GetState();
     
     EXPECT_EQ(state, "0134256");    
@@ -99,9 +102,791 @@ TEST_F(TestJobSchedulerFixture, TestEmpty) {
     // Note, this does not mean all the tasks have been finished
     EXPECT_TRUE(success);
 	
-    // sleeping long enough to ensure all tasks have executed
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    // wait until all tasks have executed
+    EXPECT_TRUE(job_ptr->Handle().WaitFor(std::chrono::seconds(1)));
     std::string state = global_state_ptr->GetState();
     
     EXPECT_EQ(state, "");    
 }
+
+
+// test fusion of linear chains
+TEST_F(TestJobSchedulerFixture, TestCompileGraphFusesChains) {
+
+	/*
+         0  1
+        / \/ \
+        2  3  4 -- 6
+        \     /
+         5----  
+	*/
+
+    job_ptr->AddTask(2, 0);
+    job_ptr->AddTask(3, 0);
+    job_ptr->AddTask(3, 1);
+    job_ptr->AddTask(4, 1);
+    job_ptr->AddTask(5, 2);
+    job_ptr->AddTask(4, 5);
+    job_ptr->AddTask(6, 4);
+
+    // no sleeping, only the order of side effects matters
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    job_ptr->SetWork([state_ptr](const uint32_t, const uint32_t data) {
+        state_ptr->Add(std::to_string(data));
+    });
+
+    // 2-5 and 4-6 are linear chains: 0, 1, [2,5], 3, [4,6]
+    GraphCompileStats stats = job_ptr->CompileGraph();
+    EXPECT_EQ(stats.nr_tasks, 7u);
+    EXPECT_EQ(stats.nr_units, 5u);
+    EXPECT_EQ(stats.nr_fused, 2u);
+    EXPECT_EQ(stats.nr_coalesced, 0u);
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+
+    job_ptr->Handle().Wait();
+    std::string state = global_state_ptr->GetState();
+
+    ASSERT_EQ(state.size(), 7u);
+    EXPECT_LT(state.find('0'), state.find('2'));
+    EXPECT_LT(state.find('2'), state.find('5'));
+    EXPECT_LT(state.find('5'), state.find('4'));
+    EXPECT_LT(state.find('1'), state.find('4'));
+    EXPECT_LT(state.find('4'), state.find('6'));
+}
+
+
+// test batching of sibling tasks
+TEST_F(TestJobSchedulerFixture, TestCompileGraphCoalescesSiblings) {
+
+    /*
+              0
+         / / / \ \ \
+        1 2 3 ... 7 8
+         \ \ \ / / /
+              9
+    */
+
+    for(uint32_t t = 1; t <= 8; t++) {
+        job_ptr->AddTask(t, 0);
+        job_ptr->AddTask(9, t);
+    }
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    job_ptr->SetWork([state_ptr](const uint32_t, const uint32_t data) {
+        state_ptr->Add(std::to_string(data));
+    });
+
+    // 0, [1,2,3,4], [5,6,7,8], 9
+    GraphCompileStats stats = job_ptr->CompileGraph(4);
+    EXPECT_EQ(stats.nr_tasks, 10u);
+    EXPECT_EQ(stats.nr_units, 4u);
+    EXPECT_EQ(stats.nr_fused, 0u);
+    EXPECT_EQ(stats.nr_coalesced, 6u);
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+
+    job_ptr->Handle().Wait();
+    std::string state = global_state_ptr->GetState();
+
+    ASSERT_EQ(state.size(), 10u);
+    EXPECT_EQ(state.front(), '0');
+    EXPECT_EQ(state.back(), '9');
+}
+
+
+// test that a failing task skips its downstream cone, but nothing else
+TEST_F(TestJobSchedulerFixture, TestFailureSkipsDownstreamCone) {
+
+    /*
+          0
+         / \
+        1   4
+        |
+        2
+        |
+        3
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+    job_ptr->AddTask(3, 2);
+    job_ptr->AddTask(4, 0);
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    job_ptr->SetWork([state_ptr](const uint32_t, const uint32_t data) {
+        if(data == 1) {
+            throw std::runtime_error("task 1 failed");
+        }
+        state_ptr->Add(std::to_string(data));
+    });
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+
+    job_ptr->Handle().Wait();
+    std::string state = global_state_ptr->GetState();
+    std::unordered_map<uint32_t, std::exception_ptr> failed = job_ptr->FailedTasks();
+
+    ASSERT_EQ(failed.size(), 1u);
+    ASSERT_EQ(failed.count(1), 1u);
+    EXPECT_THROW(std::rethrow_exception(failed.at(1)), std::runtime_error);
+    EXPECT_EQ(job_ptr->SkippedTasks(), std::set<uint32_t>({2, 3}));
+    EXPECT_TRUE(state == "04" || state == "40");
+}
+
+
+// test that a task running past its deadline is cancelled and skips its dependents
+TEST_F(TestJobSchedulerFixture, TestTaskDeadline) {
+
+    /*
+        0 -- 1 -- 2
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    job_ptr->SetCancellableWork([state_ptr](const uint32_t,
+                                            const uint32_t data,
+                                            const CancellationToken& token) {
+        if(data == 1) {
+            token.SleepFor(std::chrono::seconds(10));
+        }
+        token.ThrowIfCancelled();
+        state_ptr->Add(std::to_string(data));
+    });
+    job_ptr->SetTaskDeadline(1, std::chrono::milliseconds(50));
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+
+    job_ptr->Handle().Wait();
+    std::string state = global_state_ptr->GetState();
+    std::unordered_map<uint32_t, std::exception_ptr> failed = job_ptr->FailedTasks();
+
+    ASSERT_EQ(failed.size(), 1u);
+    ASSERT_EQ(failed.count(1), 1u);
+    EXPECT_THROW(std::rethrow_exception(failed.at(1)), TaskCancelled);
+    EXPECT_EQ(job_ptr->SkippedTasks(), std::set<uint32_t>({2}));
+    EXPECT_EQ(state, "0");
+}
+
+
+// test that deadlines apply per task, also to tasks fused by the graph compilation
+TEST_F(TestJobSchedulerFixture, TestTaskDeadlineCompiledGraph) {
+
+    /*
+        0 -- 1 -- 2     (fused into a single execution unit)
+    */
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    cancellable_work_function_t work = [state_ptr](const uint32_t,
+                                                   const uint32_t data,
+                                                   const CancellationToken& token) {
+        if(data == 1) {
+            token.SleepFor(std::chrono::milliseconds(300));
+        }
+        token.ThrowIfCancelled();
+        state_ptr->Add(std::to_string(data));
+    };
+
+    // only task 1 has a deadline
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+    job_ptr->SetCancellableWork(work);
+    EXPECT_EQ(job_ptr->CompileGraph().nr_units, 1u);
+    job_ptr->SetTaskDeadline(1, std::chrono::milliseconds(50));
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+    job_ptr->Handle().Wait();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(250));
+    EXPECT_EQ(global_state_ptr->GetState(), "0");
+    // reported per task, not per execution unit: 1 failed, 2 never ran
+    ASSERT_EQ(job_ptr->FailedTasks().size(), 1u);
+    EXPECT_EQ(job_ptr->FailedTasks().begin()->first, 1u);
+    EXPECT_THROW(std::rethrow_exception(job_ptr->FailedTasks().begin()->second), TaskCancelled);
+    EXPECT_EQ(job_ptr->SkippedTasks(), std::set<uint32_t>({2}));
+    EXPECT_EQ(job_ptr->Handle().NrCompleted(), 3u);
+
+    // every task has a deadline: task 1 cannot use the budget of tasks 0 and 2
+    JobScheduler<std::string> other_job(global_state_ptr);
+    other_job.AddTask(1, 0);
+    other_job.AddTask(2, 1);
+    other_job.SetCancellableWork(work);
+    other_job.CompileGraph();
+    for(uint32_t t = 0; t < 3; t++) {
+        other_job.SetTaskDeadline(t, std::chrono::milliseconds(t == 1 ? 50 : 400));
+    }
+
+    EXPECT_TRUE(other_job.ProcessTasks());
+    other_job.Handle().Wait();
+    EXPECT_EQ(other_job.FailedTasks().size(), 1u);
+}
+
+
+// test that a job running past its deadline is cancelled
+TEST_F(TestJobSchedulerFixture, TestJobDeadline) {
+
+	/*
+         0  1
+        / \/ \
+        2  3  4 -- 6
+        \     /
+         5----  
+	*/
+
+    job_ptr->AddTask(2, 0);
+    job_ptr->AddTask(3, 0);
+    job_ptr->AddTask(3, 1);
+    job_ptr->AddTask(4, 1);
+    job_ptr->AddTask(5, 2);
+    job_ptr->AddTask(4, 5);
+    job_ptr->AddTask(6, 4);
+
+    // only task 0 (which does not sleep) finishes in time
+    job_ptr->SetJobDeadline(std::chrono::milliseconds(200));
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(job_ptr->ProcessTasks());
+    
+    job_ptr->Handle().Wait();
+    std::string state = global_state_ptr->GetState();
+
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+    EXPECT_EQ(state, "0");
+    EXPECT_EQ(job_ptr->FailedTasks().size() + job_ptr->SkippedTasks().size(), 6u);
+}
+
+
+// test waiting for a job and following its progress
+TEST_F(TestJobSchedulerFixture, TestWaitAndProgress) {
+
+    /*
+        0 -- 1 -- 2
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    job_ptr->SetWork([state_ptr](const uint32_t, const uint32_t data) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        state_ptr->Add(std::to_string(data));
+    });
+
+    JobHandle handle = job_ptr->Handle();
+    std::vector<uint32_t> progress;
+    handle.OnProgress([&progress](uint32_t unit_id, uint32_t nr_completed, uint32_t nr_total) {
+        EXPECT_EQ(nr_total, 3u);
+        EXPECT_EQ(nr_completed, progress.size() + 1);
+        progress.emplace_back(unit_id);
+    });
+
+    // not started yet
+    EXPECT_FALSE(handle.WaitFor(std::chrono::milliseconds(10)));
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+    EXPECT_FALSE(handle.WaitFor(std::chrono::milliseconds(10)));
+
+    handle.Future().wait();
+    EXPECT_EQ(global_state_ptr->GetState(), "012");
+    EXPECT_EQ(progress, std::vector<uint32_t>({0, 1, 2}));
+    EXPECT_EQ(handle.NrCompleted(), 3u);
+    EXPECT_EQ(handle.NrTotal(), 3u);
+}
+
+
+// test execution in worker processes
+TEST_F(TestJobSchedulerFixture, TestWorkerProcesses) {
+
+	/*
+         0  1
+        / \/ \
+        2  3  4 -- 6
+        \     /
+         5----  
+	*/
+
+    job_ptr->AddTask(2, 0);
+    job_ptr->AddTask(3, 0);
+    job_ptr->AddTask(3, 1);
+    job_ptr->AddTask(4, 1);
+    job_ptr->AddTask(5, 2);
+    job_ptr->AddTask(4, 5);
+    job_ptr->AddTask(6, 4);
+
+    // workers report the process they ran in through shared memory
+    pid_t* pids = static_cast<pid_t*>(mmap(nullptr, 7 * sizeof(pid_t), PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(pids, MAP_FAILED);
+    job_ptr->SetWork([pids](const uint32_t, const uint32_t data) {
+        pids[data] = getpid();
+    });
+
+    std::vector<uint32_t> order;
+    job_ptr->Handle().OnProgress([&order](uint32_t unit_id, uint32_t, uint32_t) {
+        order.emplace_back(unit_id);
+    });
+
+    EXPECT_TRUE(job_ptr->ProcessTasksInWorkers(2));
+    EXPECT_TRUE(job_ptr->Handle().WaitFor(std::chrono::seconds(0)));
+
+    // dependencies are respected by the order of completions
+    ASSERT_EQ(order.size(), 7u);
+    std::vector<uint32_t> position(7);
+    for(uint32_t i = 0; i < order.size(); i++) {
+        position[order[i]] = i;
+    }
+    EXPECT_LT(position[0], position[2]);
+    EXPECT_LT(position[2], position[5]);
+    EXPECT_LT(position[5], position[4]);
+    EXPECT_LT(position[1], position[4]);
+    EXPECT_LT(position[4], position[6]);
+
+    for(uint32_t t = 0; t < 7; t++) {
+        EXPECT_GT(pids[t], 0);
+        EXPECT_NE(pids[t], getpid());
+    }
+    // side effects stay in the worker processes
+    EXPECT_EQ(global_state_ptr->GetState(), "");
+    EXPECT_TRUE(job_ptr->FailedTasks().empty());
+    munmap(pids, 7 * sizeof(pid_t));
+}
+
+TEST_F(TestJobSchedulerFixture, TestWorkerProcessesNoConcurrency) {
+    // a limit of 0 runs one unit at a time, like ProcessTasks does
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 0);
+    job_ptr->SetMaxConcurrentTasks(0);
+
+    EXPECT_TRUE(job_ptr->ProcessTasksInWorkers(2));
+    EXPECT_EQ(job_ptr->Handle().NrCompleted(), 3u);
+}
+
+
+// test failing tasks and crashing worker processes
+TEST_F(TestJobSchedulerFixture, TestWorkerFailures) {
+
+    /*
+          0
+         / \
+        1   3
+        |   |
+        2   4
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+    job_ptr->AddTask(3, 0);
+    job_ptr->AddTask(4, 3);
+
+    job_ptr->SetWork([](const uint32_t, const uint32_t data) {
+        if(data == 1) {
+            throw std::runtime_error("task 1 failed");
+        }
+        if(data == 3) {
+            _exit(1);
+        }
+    });
+
+    EXPECT_TRUE(job_ptr->ProcessTasksInWorkers(2));
+
+    std::unordered_map<uint32_t, std::exception_ptr> failed = job_ptr->FailedTasks();
+    ASSERT_EQ(failed.size(), 2u);
+    ASSERT_EQ(failed.count(1), 1u);
+    ASSERT_EQ(failed.count(3), 1u);
+    try {
+        std::rethrow_exception(failed.at(1));
+    } catch(const std::runtime_error& e) {
+        EXPECT_STREQ(e.what(), "task 1 failed");
+    }
+    try {
+        std::rethrow_exception(failed.at(3));
+    } catch(const std::runtime_error& e) {
+        EXPECT_STREQ(e.what(), "worker process died");
+    }
+    EXPECT_EQ(job_ptr->SkippedTasks(), std::set<uint32_t>({2, 4}));
+    EXPECT_EQ(job_ptr->Handle().NrCompleted(), 5u);
+
+    // fused chains [1,2] and [3,4]: failures are reported for the task which failed
+    //  within its execution unit, also if the worker died
+    JobScheduler<std::string> compiled_job(global_state_ptr);
+    compiled_job.AddTask(1, 0);
+    compiled_job.AddTask(2, 1);
+    compiled_job.AddTask(3, 0);
+    compiled_job.AddTask(4, 3);
+    compiled_job.SetWork([](const uint32_t, const uint32_t data) {
+        if(data == 2) {
+            throw std::runtime_error("task 2 failed");
+        }
+        if(data == 4) {
+            _exit(1);
+        }
+    });
+    EXPECT_EQ(compiled_job.CompileGraph().nr_units, 3u);
+
+    EXPECT_TRUE(compiled_job.ProcessTasksInWorkers(2));
+    failed = compiled_job.FailedTasks();
+    EXPECT_EQ(failed.size(), 2u);
+    EXPECT_EQ(failed.count(2), 1u);
+    EXPECT_EQ(failed.count(4), 1u);
+    EXPECT_TRUE(compiled_job.SkippedTasks().empty());
+    EXPECT_EQ(compiled_job.Handle().NrCompleted(), 5u);
+}
+
+
+// test deadlines and cancellation reaching tasks running in worker processes
+TEST_F(TestJobSchedulerFixture, TestWorkerDeadlineAndCancel) {
+
+    /*
+        0 -- 1 -- 2
+         \
+          3
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+    job_ptr->AddTask(3, 0);
+
+    // task 1 ignores its token, its worker is killed and replaced
+    job_ptr->SetWork([](const uint32_t, const uint32_t data) {
+        if(data == 1) {
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+        }
+    });
+    job_ptr->SetTaskDeadline(1, std::chrono::milliseconds(50));
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(job_ptr->ProcessTasksInWorkers(1));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+    std::unordered_map<uint32_t, std::exception_ptr> failed = job_ptr->FailedTasks();
+    ASSERT_EQ(failed.size(), 1u);
+    ASSERT_EQ(failed.count(1), 1u);
+    EXPECT_THROW(std::rethrow_exception(failed.at(1)), TaskCancelled);
+    EXPECT_EQ(job_ptr->SkippedTasks(), std::set<uint32_t>({2}));
+    // task 3 ran on the new worker
+    EXPECT_EQ(job_ptr->Handle().NrCompleted(), 4u);
+
+    // Cancel() reaches a task running in a worker
+    JobScheduler<std::string> cancelled_job(global_state_ptr);
+    cancelled_job.AddTask(1, 0);
+    cancelled_job.SetCancellableWork([](const uint32_t, const uint32_t,
+                                        const CancellationToken& token) {
+        token.SleepFor(std::chrono::seconds(5));
+        token.ThrowIfCancelled();
+    });
+
+    std::thread canceller([&cancelled_job]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        cancelled_job.Cancel();
+    });
+    start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(cancelled_job.ProcessTasksInWorkers(1));
+    canceller.join();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+    failed = cancelled_job.FailedTasks();
+    ASSERT_EQ(failed.count(0), 1u);
+    EXPECT_THROW(std::rethrow_exception(failed.at(0)), TaskCancelled);
+    EXPECT_EQ(cancelled_job.SkippedTasks(), std::set<uint32_t>({1}));
+}
+
+
+// test tasks spawning sub graphs (nested fork-join)
+TEST_F(TestJobSchedulerFixture, TestNestedForkJoin) {
+
+    /*
+        0 -- 1 -- 2      task 1 spawns:   a -- b,c,d -- e     a spawns:   x -- y
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    JobScheduler<std::string>* job = job_ptr.get();
+
+    SubGraph chain;
+    chain.AddTask(1, 0);
+    chain.SetWork([state_ptr](const uint32_t local_id, const CancellationToken&) {
+        state_ptr->Add(std::string(1, "xy"[local_id]));
+    });
+
+    SubGraph diamond;
+    for(uint32_t t = 1; t <= 3; t++) {
+        diamond.AddTask(t, 0);
+        diamond.AddTask(4, t);
+    }
+    diamond.SetWork([state_ptr, job, chain](const uint32_t local_id, const CancellationToken&) {
+        state_ptr->Add(std::string(1, 'a' + local_id));
+        if(local_id == 0) {
+            job->Spawn(chain);
+        }
+    });
+
+    job_ptr->SetWork([state_ptr, job, diamond](const uint32_t, const uint32_t data) {
+        state_ptr->Add(std::to_string(data));
+        if(data == 1) {
+            // returns right away, task 2 waits for the whole sub graph nevertheless
+            EXPECT_EQ(job->Spawn(diamond).size(), 5u);
+        }
+    });
+
+    // spawning outside of a running task is rejected
+    EXPECT_THROW(job_ptr->Spawn(chain), std::logic_error);
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+    job_ptr->Handle().Wait();
+
+    std::string state = global_state_ptr->GetState();
+    ASSERT_EQ(state.size(), 10u);
+    EXPECT_EQ(state.substr(0, 5), "01axy");
+    std::string siblings = state.substr(5, 3);
+    std::sort(siblings.begin(), siblings.end());
+    EXPECT_EQ(siblings, "bcd");
+    EXPECT_EQ(state.substr(8), "e2");
+
+    EXPECT_EQ(job_ptr->Handle().NrTotal(), 10u);
+    EXPECT_EQ(job_ptr->Handle().NrCompleted(), 10u);
+    EXPECT_TRUE(job_ptr->FailedTasks().empty());
+}
+
+
+// test a failing task of a spawned sub graph failing the spawning task
+TEST_F(TestJobSchedulerFixture, TestNestedForkJoinFailure) {
+
+    /*
+        0 -- 1 -- 2      task 1 spawns:   a -- b
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    JobScheduler<std::string>* job = job_ptr.get();
+
+    SubGraph sub_graph;
+    sub_graph.AddTask(1, 0);
+    sub_graph.SetWork([state_ptr](const uint32_t local_id, const CancellationToken&) {
+        if(local_id == 0) {
+            throw std::runtime_error("spawned task a failed");
+        }
+        state_ptr->Add("b");
+    });
+
+    std::unordered_map<uint32_t, uint32_t> unit_ids;
+    job_ptr->SetWork([state_ptr, job, sub_graph, &unit_ids](const uint32_t, const uint32_t data) {
+        state_ptr->Add(std::to_string(data));
+        if(data == 1) {
+            unit_ids = job->Spawn(sub_graph);
+        }
+    });
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+    job_ptr->Handle().Wait();
+
+    EXPECT_EQ(global_state_ptr->GetState(), "01");
+    std::unordered_map<uint32_t, std::exception_ptr> failed = job_ptr->FailedTasks();
+    ASSERT_EQ(failed.size(), 2u);
+    EXPECT_EQ(failed.count(unit_ids.at(0)), 1u);
+    EXPECT_EQ(failed.count(1), 1u);
+    EXPECT_THROW(std::rethrow_exception(failed.at(1)), std::runtime_error);
+    EXPECT_EQ(job_ptr->SkippedTasks(), std::set<uint32_t>({unit_ids.at(1), 2}));
+    EXPECT_EQ(job_ptr->Handle().NrCompleted(), 5u);
+}
+
+
+// test fork-join from a task fused into an execution unit with the tasks after it
+TEST_F(TestJobSchedulerFixture, TestNestedForkJoinCompiledGraph) {
+
+    /*
+        0 -- 1 -- 2 -- 3      (fused)   task 1 spawns:   a,   task 2 fails
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+    job_ptr->AddTask(3, 2);
+    EXPECT_EQ(job_ptr->CompileGraph().nr_units, 1u);
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    JobScheduler<std::string>* job = job_ptr.get();
+
+    SubGraph sub_graph;
+    sub_graph.AddTask(0);
+    sub_graph.SetWork([state_ptr](const uint32_t, const CancellationToken&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        state_ptr->Add("a");
+    });
+
+    job_ptr->SetWork([state_ptr, job, sub_graph](const uint32_t, const uint32_t data) {
+        state_ptr->Add(std::to_string(data));
+        if(data == 1) {
+            job->Spawn(sub_graph);
+        }
+        if(data == 2) {
+            throw std::invalid_argument("task 2 failed");
+        }
+    });
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+    job_ptr->Handle().Wait();
+
+    // the sub graph joins before the remaining tasks of the unit
+    EXPECT_EQ(global_state_ptr->GetState(), "01a2");
+    std::unordered_map<uint32_t, std::exception_ptr> failed = job_ptr->FailedTasks();
+    ASSERT_EQ(failed.size(), 1u);
+    ASSERT_EQ(failed.count(2), 1u);
+    EXPECT_THROW(std::rethrow_exception(failed.at(2)), std::invalid_argument);
+    EXPECT_EQ(job_ptr->SkippedTasks(), std::set<uint32_t>({3}));
+    EXPECT_EQ(job_ptr->Handle().NrCompleted(), 5u);
+}
+
+
+// test spawned tasks respecting the load limit and the ids of fused tasks
+TEST_F(TestJobSchedulerFixture, TestNestedForkJoinLoadLimit) {
+
+    /*
+        0 -- 1 -- 2      (fused into a single execution unit)   task 1 spawns 200 tasks
+    */
+
+    job_ptr->AddTask(1, 0);
+    job_ptr->AddTask(2, 1);
+    EXPECT_EQ(job_ptr->CompileGraph().nr_units, 1u);
+    job_ptr->SetMaxConcurrentTasks(2);
+
+    SubGraph fan_out;
+    for(uint32_t t = 0; t < 200; t++) {
+        fan_out.AddTask(t);
+    }
+
+    std::atomic<uint32_t> nr_working(0);
+    std::atomic<uint32_t> peak(0);
+    std::atomic<uint32_t> nr_spawned_done(0);
+    std::atomic<uint32_t> nr_spawned_done_before_2(0);
+    std::function<void()> work = [&nr_working, &peak]() {
+        uint32_t working = ++nr_working;
+        uint32_t previous = peak.load();
+        while(working > previous && !peak.compare_exchange_weak(previous, working)) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        nr_working--;
+    };
+    fan_out.SetWork([work, &nr_spawned_done](const uint32_t, const CancellationToken&) {
+        work();
+        nr_spawned_done++;
+    });
+
+    JobScheduler<std::string>* job = job_ptr.get();
+    std::unordered_map<uint32_t, uint32_t> unit_ids;
+    job_ptr->SetWork([job, fan_out, work, &unit_ids, &nr_spawned_done,
+                      &nr_spawned_done_before_2](const uint32_t, const uint32_t data) {
+        if(data == 1) {
+            unit_ids = job->Spawn(fan_out);
+        }
+        if(data == 2) {
+            nr_spawned_done_before_2 = nr_spawned_done.load();
+        }
+        work();
+    });
+
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+    job_ptr->Handle().Wait();
+
+    EXPECT_LE(peak.load(), 2u);
+    EXPECT_EQ(job_ptr->Handle().NrCompleted(), 203u);
+    EXPECT_TRUE(job_ptr->FailedTasks().empty());
+    // task 2 (fused after the spawning task) runs once the sub graph is joined
+    EXPECT_EQ(nr_spawned_done_before_2.load(), 200u);
+
+    // spawned units do not reuse the ids of the tasks absorbed by the fused unit
+    ASSERT_EQ(unit_ids.size(), 200u);
+    for(const auto& unit_id : unit_ids) {
+        EXPECT_GT(unit_id.second, 2u);
+    }
+}
+
+
+// test building the graph from many threads at the same time
+TEST_F(TestJobSchedulerFixture, TestGraphBuilder) {
+
+    /*
+        0 -- 1 -- 2 -- ... -- 99      (every 4th dependency added by the same thread)
+    */
+
+    GraphBuilder builder(3);
+    std::vector<std::thread> producers;
+    for(uint32_t p = 0; p < 4; p++) {
+        producers.emplace_back([&builder, p]() {
+            for(uint32_t t = 1 + p; t < 100; t += 4) {
+                builder.AddTask(t, t - 1);
+            }
+        });
+    }
+    for(auto& producer : producers) {
+        producer.join();
+    }
+    job_ptr->AddTasks(builder);
+    EXPECT_TRUE(builder.TakeEdges()[0].empty());
+
+    std::string expected_state;
+    for(uint32_t t = 0; t < 100; t++) {
+        expected_state += std::to_string(t);
+    }
+
+    std::shared_ptr<GlobalState<std::string>> state_ptr = global_state_ptr;
+    job_ptr->SetWork([state_ptr](const uint32_t, const uint32_t data) {
+        state_ptr->Add(std::to_string(data));
+    });
+    EXPECT_TRUE(job_ptr->ProcessTasks());
+    job_ptr->Handle().Wait();
+    EXPECT_EQ(global_state_ptr->GetState(), expected_state);
+    EXPECT_EQ(job_ptr->Handle().NrTotal(), 100u);
+}
+
+
+// test a graph built by many threads is the same as a graph built by one thread
+TEST_F(TestJobSchedulerFixture, TestGraphBuilderMatchesAddTask) {
+    const uint32_t nr_tasks = 20000;
+    GraphBuilder builder;
+    std::vector<std::thread> producers;
+    for(uint32_t p = 0; p < 8; p++) {
+        producers.emplace_back([&builder, p, nr_tasks]() {
+            for(uint32_t t = 1 + p; t < nr_tasks; t += 8) {
+                builder.AddTask(t, (t * 2654435761u) % t);
+                builder.AddTask(t, t / 2);
+            }
+        });
+    }
+    for(auto& producer : producers) {
+        producer.join();
+    }
+    job_ptr->AddTasks(builder);
+
+    JobScheduler<std::string> serial_job(global_state_ptr);
+    for(uint32_t t = 1; t < nr_tasks; t++) {
+        serial_job.AddTask(t, (t * 2654435761u) % t);
+        serial_job.AddTask(t, t / 2);
+    }
+
+    // the producers interleave, so lists are compared regardless of their order
+    auto sorted = [](std::vector<uint32_t> tasks) {
+        std::sort(tasks.begin(), tasks.end());
+        return tasks;
+    };
+    ASSERT_EQ(job_ptr->TaskIds(), serial_job.TaskIds());
+    for(const auto t : serial_job.TaskIds()) {
+        EXPECT_EQ(sorted(job_ptr->ChildTasks(t)), sorted(serial_job.ChildTasks(t))) << t;
+        EXPECT_EQ(sorted(job_ptr->ParentTasks(t)), sorted(serial_job.ParentTasks(t))) << t;
+        EXPECT_EQ(job_ptr->Indegree(t), serial_job.Indegree(t)) << t;
+    }
+
+    // dependencies added before are kept
+    JobScheduler<std::string> mixed_job(global_state_ptr);
+    mixed_job.AddTask(1, 0);
+    builder.AddTask(1, 0);
+    builder.AddTask(2, 1);
+    mixed_job.AddTasks(builder);
+    EXPECT_EQ(mixed_job.TaskIds(), std::set<uint32_t>({0, 1, 2}));
+    EXPECT_EQ(mixed_job.ChildTasks(0), std::vector<uint32_t>({1, 1}));
+    EXPECT_EQ(mixed_job.ParentTasks(1), std::vector<uint32_t>({0, 0}));
+    EXPECT_EQ(mixed_job.Indegree(1), 2u);
+    EXPECT_EQ(mixed_job.Indegree(2), 1u);
+}
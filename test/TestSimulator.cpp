@@ -0,0 +1,142 @@
+
+#include "gtest/gtest.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "./../src/JobScheduler.h"
+#include "./../src/Simulator.h"
+
+
+/// \brief Units 0..width+1 in dispatch order: a root fanning out into "width" units,
+///        which are joined by a sink. Every unit costs 1.
+/// \param[in] Number of units between root and sink
+/// \return The simulator
+static Simulator FanOut(uint32_t width) {
+    std::vector<uint32_t> unit_ids;
+    std::vector<std::vector<uint32_t>> parents(width + 2);
+    for(uint32_t u = 0; u < width + 2; u++) {
+        unit_ids.emplace_back(u);
+    }
+    for(uint32_t u = 1; u <= width; u++) {
+        parents[u].emplace_back(0);
+        parents[width + 1].emplace_back(u);
+    }
+    return Simulator(unit_ids, parents, std::vector<double>(width + 2, 1.0));
+}
+
+
+// test makespan, utilization and critical path of a linear chain
+TEST(TestSimulator, TestChain) {
+
+    /*
+        7 -- 8 -- 9     (costs 1, 2, 3)
+    */
+
+    Simulator simulator({7, 8, 9}, {{}, {0}, {1}}, {1.0, 2.0, 3.0});
+    SimulationReport report = simulator.Run(4, 2);
+
+    EXPECT_DOUBLE_EQ(report.makespan, 6.0);
+    EXPECT_DOUBLE_EQ(report.busy_time, 6.0);
+    EXPECT_DOUBLE_EQ(report.utilization, 0.5);
+    EXPECT_DOUBLE_EQ(report.critical_path_length, 6.0);
+    EXPECT_EQ(report.critical_path, std::vector<uint32_t>({7, 8, 9}));
+}
+
+
+// test the load limit and the number of cores limiting a fan-out
+TEST(TestSimulator, TestFanOut) {
+    Simulator simulator = FanOut(8);
+
+    // plenty of cores: all 8 units run at once
+    SimulationReport report = simulator.Run(100, 100);
+    EXPECT_DOUBLE_EQ(report.makespan, 3.0);
+    EXPECT_DOUBLE_EQ(report.critical_path_length, 3.0);
+    EXPECT_EQ(report.critical_path.size(), 3u);
+
+    // 4 cores: two rounds
+    EXPECT_DOUBLE_EQ(simulator.Run(100, 4).makespan, 4.0);
+
+    // at most 2 units in flight (the scheduler dispatches while at most 1 is running):
+    //  the root, then 4 rounds of 2 units, then the sink
+    report = simulator.Run(1, 4);
+    EXPECT_DOUBLE_EQ(report.makespan, 6.0);
+    EXPECT_DOUBLE_EQ(report.utilization, 10.0 / (6.0 * 4));
+}
+
+
+// test recommending a limit of concurrent tasks
+TEST(TestSimulator, TestSweep) {
+    ConcurrencySweep sweep = FanOut(8).Sweep({1, 2, 4, 8}, 4);
+
+    ASSERT_EQ(sweep.reports.size(), 4u);
+    EXPECT_DOUBLE_EQ(sweep.reports[0].makespan, 6.0);
+    EXPECT_DOUBLE_EQ(sweep.reports[1].makespan, 5.0);
+    EXPECT_DOUBLE_EQ(sweep.reports[2].makespan, 4.0);
+    EXPECT_DOUBLE_EQ(sweep.reports[3].makespan, 4.0);
+    // more than 4 does not help on 4 cores
+    EXPECT_EQ(sweep.recommended_max_concurrent_tasks, 4u);
+
+    // a chain does not benefit from any concurrency: the smallest candidate (0, i.e. one
+    //  task at a time) is recommended
+    std::vector<uint32_t> unit_ids;
+    std::vector<std::vector<uint32_t>> parents(10);
+    for(uint32_t u = 0; u < 10; u++) {
+        unit_ids.emplace_back(u);
+        if(u > 0) {
+            parents[u].emplace_back(u - 1);
+        }
+    }
+    Simulator chain(unit_ids, parents, std::vector<double>(10, 1.0));
+    EXPECT_EQ(chain.Sweep({2, 0, 1, 4}, 4).recommended_max_concurrent_tasks, 0u);
+}
+
+
+// test simulating the graph of a job scheduler
+TEST(TestSimulator, TestJobScheduler) {
+
+    /*
+         0  1
+        / \/ \
+        2  3  4 -- 6
+        \     /
+         5----
+    */
+
+    std::shared_ptr<GlobalState<std::string>> global_state_ptr =
+        std::make_shared<GlobalState<std::string>>();
+    JobScheduler<std::string> job(global_state_ptr);
+    job.AddTask(2, 0);
+    job.AddTask(3, 0);
+    job.AddTask(3, 1);
+    job.AddTask(4, 1);
+    job.AddTask(5, 2);
+    job.AddTask(4, 5);
+    job.AddTask(6, 4);
+
+    // same durations as the default work: "task id" seconds, task 2 sleeps 10s extra
+    task_cost_function_t cost = [](const uint32_t task_id) {
+        return task_id + (task_id == 2 ? 10.0 : 0.0);
+    };
+
+    SimulationReport report = job.Simulate(cost, 8);
+    EXPECT_EQ(report.critical_path, std::vector<uint32_t>({0, 2, 5, 4, 6}));
+    EXPECT_DOUBLE_EQ(report.critical_path_length, 0 + 12 + 5 + 4 + 6);
+    EXPECT_DOUBLE_EQ(report.makespan, report.critical_path_length);
+    EXPECT_DOUBLE_EQ(report.busy_time, 31.0);
+
+    // fusing the chain 2-5 does not change the prediction
+    job.CompileGraph();
+    EXPECT_DOUBLE_EQ(job.Simulate(cost, 8).makespan, report.makespan);
+
+    ConcurrencySweep sweep = job.SweepConcurrency(cost, 8, {0, 1, 2, 4});
+    EXPECT_EQ(sweep.reports.size(), 4u);
+    EXPECT_GE(sweep.reports[0].makespan, sweep.reports[3].makespan);
+    job.SetMaxConcurrentTasks(sweep.recommended_max_concurrent_tasks);
+
+    // a cycle cannot be simulated
+    JobScheduler<std::string> cyclic_job(global_state_ptr);
+    cyclic_job.AddTask(1, 0);
+    cyclic_job.AddTask(0, 1);
+    EXPECT_THROW(cyclic_job.Simulate(cost, 8), std::invalid_argument);
+}
@@ -0,0 +1,80 @@
+
+#include "gtest/gtest.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "./../src/StaticDag.h"
+#include "./../src/State.h"
+
+/*
+     0  1
+    / \/ \
+    2  3  4 -- 6
+    \     /
+     5----  
+*/
+static constexpr auto kDagA = MakeStaticDag<7>({
+    {2, 0}, {3, 0}, {3, 1}, {4, 1}, {5, 2}, {4, 5}, {6, 4}});
+
+// everything below is evaluated by the compiler
+static_assert(kDagA.NrTasks() == 7, "number of tasks");
+static_assert(kDagA.NrEdges() == 7, "number of edges");
+static_assert(kDagA.Indegree(4) == 2, "4 depends on 1 and 5");
+static_assert(kDagA.NrChildren(0) == 2, "2 and 3 depend on 0");
+static_assert(kDagA.NrLevels() == 5, "longest path 0-2-5-4-6");
+
+
+// test the topological order and levels computed at compile time
+TEST(TestStaticDag, TestOrderAndLevels) {
+    constexpr uint32_t expected_order[] = {0, 1, 2, 3, 5, 4, 6};
+    constexpr uint32_t expected_levels[] = {0, 0, 1, 1, 3, 2, 4};
+
+    for(uint32_t i = 0; i < kDagA.NrTasks(); i++) {
+        EXPECT_EQ(kDagA.Order(i), expected_order[i]);
+        EXPECT_EQ(kDagA.Level(i), expected_levels[i]);
+    }
+}
+
+
+// test that the executor respects all dependencies
+TEST(TestStaticDag, TestExecutor) {
+    GlobalState<std::string> global_state;
+    StaticExecutor<kDagA> executor;
+
+    EXPECT_TRUE(executor.Run([&global_state](uint32_t task_id) {
+        global_state.Add(std::to_string(task_id));
+    }, 4));
+
+    std::string state = global_state.GetState();
+    ASSERT_EQ(state.size(), 7u);
+    for(std::size_t e = 0; e < kDagA.NrEdges(); e++) {
+        StaticEdge edge = kDagA.Edge(e);
+        EXPECT_LT(state.find(std::to_string(edge.depends_on_task_id)),
+                  state.find(std::to_string(edge.task_id)));
+    }
+}
+
+
+// test a failing task skipping its downstream cone, and rejecting zero workers
+TEST(TestStaticDag, TestExecutorFailure) {
+    GlobalState<std::string> global_state;
+    StaticExecutor<kDagA> executor;
+
+    EXPECT_FALSE(executor.Run([&global_state](uint32_t task_id) {
+        if(task_id == 2) {
+            throw std::runtime_error("task 2 failed");
+        }
+        global_state.Add(std::to_string(task_id));
+    }, 2));
+
+    std::string state = global_state.GetState();
+    std::sort(state.begin(), state.end());
+    EXPECT_EQ(state, "013");
+    std::unordered_map<uint32_t, std::exception_ptr> failed = executor.FailedTasks();
+    ASSERT_EQ(failed.size(), 1u);
+    EXPECT_THROW(std::rethrow_exception(failed.at(2)), std::runtime_error);
+    EXPECT_EQ(executor.SkippedTasks(), std::set<uint32_t>({4, 5, 6}));
+
+    EXPECT_THROW(executor.Run([](uint32_t) {}, 0), std::invalid_argument);
+}